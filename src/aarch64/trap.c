@@ -43,6 +43,8 @@ void trap_global_handler(UserContext *context)
     }
     }
     
+    check_resched();
+
     // Lab4: stop killed process while returning to user space
     if (thisproc()->killed && (context->spsr & SPSR_EL1_DAIF_MASK) == 0) {
         exit(-1);
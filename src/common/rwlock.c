@@ -0,0 +1,61 @@
+#include <aarch64/intrinsic.h>
+#include <common/rwlock.h>
+
+#define RW_WRITER (1u << 31)
+#define RW_WAITING (1u << 30) // a writer spins, readers keep out
+
+void init_rwlock(RWLock *lock)
+{
+    lock->val = 0;
+}
+
+void acquire_read_lock(RWLock *lock)
+{
+    while (1) {
+        u32 v = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+        if (!(v & (RW_WRITER | RW_WAITING)) &&
+            __atomic_compare_exchange_n(&lock->val, &v, v + 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+        arch_yield();
+    }
+}
+
+void release_read_lock(RWLock *lock)
+{
+    __atomic_fetch_sub(&lock->val, 1, __ATOMIC_RELEASE);
+}
+
+bool try_acquire_write_lock(RWLock *lock)
+{
+    u32 v = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+    if (v & ~RW_WAITING)
+        return false;
+    return __atomic_compare_exchange_n(&lock->val, &v, RW_WRITER, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void acquire_write_lock(RWLock *lock)
+{
+    while (1) {
+        u32 v = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+        // taking the lock clears RW_WAITING; writers still waiting set it
+        // again on their next round
+        if (!(v & ~RW_WAITING)) {
+            if (__atomic_compare_exchange_n(&lock->val, &v, RW_WRITER, false,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED))
+                return;
+            continue;
+        }
+        if (!(v & RW_WAITING))
+            __atomic_fetch_or(&lock->val, RW_WAITING, __ATOMIC_RELAXED);
+        arch_yield();
+    }
+}
+
+void release_write_lock(RWLock *lock)
+{
+    // keep RW_WAITING, so that a waiting writer goes before new readers
+    __atomic_fetch_and(&lock->val, ~RW_WRITER, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <common/defines.h>
+
+/**
+ * reader-writer spin lock for read-mostly data: any number of readers or one
+ * writer. a waiting writer holds new readers off, so a stream of readers
+ * cannot starve it; a reader must therefore not take the same lock again.
+ * all-zero is an unlocked lock.
+ */
+typedef struct {
+    volatile u32 val; // reader count, RW_WRITER and RW_WAITING
+} RWLock;
+
+void init_rwlock(RWLock *);
+void acquire_read_lock(RWLock *);
+void release_read_lock(RWLock *);
+WARN_RESULT bool try_acquire_write_lock(RWLock *);
+void acquire_write_lock(RWLock *);
+void release_write_lock(RWLock *);
@@ -1,8 +1,8 @@
 #include <common/sem.h>
-#include <kernel/mem.h>
 #include <kernel/sched.h>
 #include <kernel/printk.h>
 #include <common/list.h>
+#include <kernel/syscall.h>
 
 void init_sem(Semaphore *sem, int val)
 {
@@ -65,32 +65,34 @@ bool _wait_sem(Semaphore *sem, bool alertable)
         release_spinlock(&sem->lock);
         return true;
     }
-    WaitData *wait = kalloc(sizeof(WaitData));
-    wait->proc = thisproc();
-    wait->up = false;
-    _insert_into_list(&sem->sleeplist, &wait->slnode);
+    // the wait record lives on our stack: _post_sem only touches it under
+    // sem->lock, and we take that lock again before returning
+    WaitData wait = {.up = false, .proc = thisproc()};
+    _insert_into_list(&sem->sleeplist, &wait.slnode);
     acquire_sched_lock();
     release_spinlock(&sem->lock);
     sched(alertable ? SLEEPING : DEEPSLEEPING);
     acquire_spinlock(&sem->lock); // also the lock for waitdata
-    if (!wait->up) // wakeup by other sources
+    if (!wait.up) // wakeup by other sources
     {
         ASSERT(++sem->val <= 0);
-        _detach_from_list(&wait->slnode);
+        _detach_from_list(&wait.slnode);
     }
+    bool ret = wait.up;
     release_spinlock(&sem->lock);
-    bool ret = wait->up;
-    kfree(wait);
     return ret;
 }
 
-void _post_sem(Semaphore *sem)
+Proc *_post_sem(Semaphore *sem)
 {
     if (++sem->val <= 0) {
         ASSERT(!_empty_list(&sem->sleeplist));
         auto wait = container_of(sem->sleeplist.prev, WaitData, slnode);
+        Proc *p = wait->proc;
         wait->up = true;
         _detach_from_list(&wait->slnode);
-        activate_proc(wait->proc);
+        activate_proc(p);
+        return p;
     }
+    return NULL;
 }
\ No newline at end of file
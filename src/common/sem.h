@@ -17,7 +17,9 @@ typedef struct {
 } Semaphore;
 
 void init_sem(Semaphore *, int val);
-void _post_sem(Semaphore *);
+// the sleeper woken, or NULL. hand it the CPU with yield_to() to cut the
+// latency of a handoff
+struct Proc *_post_sem(Semaphore *);
 WARN_RESULT bool _wait_sem(Semaphore *, bool alertable);
 bool _get_sem(Semaphore *);
 WARN_RESULT int _query_sem(Semaphore *);
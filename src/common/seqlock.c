@@ -0,0 +1,37 @@
+#include <aarch64/intrinsic.h>
+#include <common/seqlock.h>
+
+void init_seqlock(SeqLock *sl)
+{
+    sl->seq = 0;
+    init_spinlock(&sl->lock);
+}
+
+u32 read_seqbegin(SeqLock *sl)
+{
+    u32 seq;
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+        arch_yield();
+    return seq;
+}
+
+bool read_seqretry(SeqLock *sl, u32 start)
+{
+    // order the reads of the data before the second read of seq
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+void write_seqlock(SeqLock *sl)
+{
+    acquire_spinlock(&sl->lock);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    // make the odd seq visible before any store to the data
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void write_sequnlock(SeqLock *sl)
+{
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+    release_spinlock(&sl->lock);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <common/spinlock.h>
+
+/**
+ * sequence lock: writers serialize on a spinlock and bump `seq` before and
+ * after their update, readers take no lock at all and retry when `seq`
+ * changed under them.
+ *
+ *     u32 seq;
+ *     do {
+ *         seq = read_seqbegin(&sl);
+ *         ... copy the data out ...
+ *     } while (read_seqretry(&sl, seq));
+ *
+ * readers may see a torn update before they retry, so the protected data
+ * must stay safe to read (not freed) while a writer changes it.
+ */
+typedef struct {
+    volatile u32 seq; // odd while a writer is inside
+    SpinLock lock;
+} SeqLock;
+
+void init_seqlock(SeqLock *);
+WARN_RESULT u32 read_seqbegin(SeqLock *);
+WARN_RESULT bool read_seqretry(SeqLock *, u32 start);
+void write_seqlock(SeqLock *);
+void write_sequnlock(SeqLock *);
@@ -1,28 +1,128 @@
 #include <aarch64/intrinsic.h>
 #include <common/spinlock.h>
+#include <kernel/printk.h>
+
+#ifdef SPINLOCK_PROFILE
+
+#define LOCK_STAT_SIZE 512
+#define LOCK_STAT_DUMP 16
+
+// open addressing on the lock address. locks of freed objects keep their
+// slot, so a new lock at the same address adds to the old statistics
+static struct lock_stat lock_stats[LOCK_STAT_SIZE];
+
+static struct lock_stat *lock_stat_of(SpinLock *lock)
+{
+    u64 h = (u64)lock * 0x9e3779b97f4a7c15ull >> 32;
+    for (int i = 0; i != LOCK_STAT_SIZE; i++) {
+        struct lock_stat *st = &lock_stats[(h + i) % LOCK_STAT_SIZE];
+        SpinLock *cur = __atomic_load_n(&st->lock, __ATOMIC_ACQUIRE);
+        if (cur == NULL &&
+            __atomic_compare_exchange_n(&st->lock, &cur, lock, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return st;
+        if (cur == lock)
+            return st;
+    }
+    return NULL;
+}
+
+static void record_acquire(SpinLock *lock, u64 spin, void *pc)
+{
+    struct lock_stat *st = lock_stat_of(lock);
+    lock->hold_start = get_timestamp();
+    if (!st)
+        return;
+    __atomic_fetch_add(&st->acquires, 1, __ATOMIC_RELAXED);
+    if (spin) {
+        __atomic_fetch_add(&st->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&st->spin_ticks, spin, __ATOMIC_RELAXED);
+        st->pc = pc;
+    }
+}
+
+static void record_release(SpinLock *lock)
+{
+    u64 hold = get_timestamp() - lock->hold_start;
+    struct lock_stat *st = lock_stat_of(lock);
+    if (!st)
+        return;
+    u64 max = __atomic_load_n(&st->max_hold, __ATOMIC_RELAXED);
+    while (hold > max &&
+           !__atomic_compare_exchange_n(&st->max_hold, &max, hold, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void dump_lock_stats()
+{
+    static bool shown[LOCK_STAT_SIZE];
+    u64 freq = get_clock_frequency();
+    for (int i = 0; i != LOCK_STAT_SIZE; i++)
+        shown[i] = false;
+    // printk has no field widths
+    printk("lock\twaiter pc\tacquires\tcontended\tspin us\tmax hold us\n");
+    for (int n = 0; n != LOCK_STAT_DUMP; n++) {
+        int top = -1;
+        for (int i = 0; i != LOCK_STAT_SIZE; i++)
+            if (lock_stats[i].lock && !shown[i] &&
+                (top < 0 || lock_stats[i].spin_ticks > lock_stats[top].spin_ticks))
+                top = i;
+        if (top < 0)
+            break;
+        shown[top] = true;
+        struct lock_stat *st = &lock_stats[top];
+        printk("%p\t%p\t%llu\t%llu\t%llu\t%llu\n", st->lock, st->pc,
+               st->acquires, st->contended, st->spin_ticks * 1000000 / freq,
+               st->max_hold * 1000000 / freq);
+    }
+}
+
+#endif
 
 void init_spinlock(SpinLock *lock)
 {
-    lock->locked = 0;
+    lock->val = 0;
 }
 
 bool try_acquire_spinlock(SpinLock *lock)
 {
-    if (!lock->locked &&
-        !__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
-        return true;
-    } else {
+    u32 v = lock->val;
+    // free when every ticket handed out has been served
+    if ((u16)v != (u16)(v >> 16))
         return false;
-    }
+    if (!__atomic_compare_exchange_n(&lock->val, &v, v + (1u << 16), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+#ifdef SPINLOCK_PROFILE
+    record_acquire(lock, 0, __builtin_return_address(0));
+#endif
+    return true;
 }
 
 void acquire_spinlock(SpinLock *lock)
 {
-    while (!try_acquire_spinlock(lock))
+    u16 ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+#ifdef SPINLOCK_PROFILE
+    u64 spin = 0;
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        u64 t0 = get_timestamp();
+        while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+            arch_yield();
+        spin = MAX(get_timestamp() - t0, 1ull);
+    }
+    record_acquire(lock, spin, __builtin_return_address(0));
+#else
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
         arch_yield();
+#endif
 }
 
 void release_spinlock(SpinLock *lock)
 {
-    __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+#ifdef SPINLOCK_PROFILE
+    record_release(lock);
+#endif
+    // only the holder writes owner
+    __atomic_store_n(&lock->owner, (u16)(lock->owner + 1), __ATOMIC_RELEASE);
 }
@@ -3,11 +3,40 @@
 #include <common/defines.h>
 #include <aarch64/intrinsic.h>
 
+/**
+ * ticket lock: an acquirer takes a ticket from `next` and owns the lock once
+ * `owner` reaches it, so waiters are served in arrival order and only spin
+ * reading, not writing, the lock word. all-zero is an unlocked lock.
+ */
 typedef struct {
-    volatile bool locked;
+    union {
+        volatile u32 val;
+        struct {
+            volatile u16 owner;
+            volatile u16 next;
+        };
+    };
+#ifdef SPINLOCK_PROFILE
+    u64 hold_start;
+#endif
 } SpinLock;
 
 void init_spinlock(SpinLock *);
 WARN_RESULT bool try_acquire_spinlock(SpinLock *);
 void acquire_spinlock(SpinLock *);
 void release_spinlock(SpinLock *);
+
+#ifdef SPINLOCK_PROFILE
+// contention statistics of one lock, built with -DSPINLOCK_PROFILE=ON
+struct lock_stat {
+    SpinLock *lock;
+    void *pc; // a recent caller that had to wait
+    u64 acquires;
+    u64 contended;
+    u64 spin_ticks; // timer counter ticks spent waiting
+    u64 max_hold; // longest hold, in ticks
+};
+
+// print the locks waited on the longest
+void dump_lock_stats();
+#endif
@@ -14,14 +14,13 @@ void init_clock()
 {
     // reserve one second for the first time.
     enable_timer();
-    reset_clock(10);
+    reset_clock(ms_to_ticks(10));
 }
 
-void reset_clock(u64 interval_ms)
+void reset_clock(u64 interval)
 {
-    u64 interval_clk = interval_ms * get_clock_frequency() / 1000;
-    ASSERT(interval_clk <= 0x7fffffff);
-    set_cntv_tval_el0(interval_clk);
+    ASSERT(interval <= 0x7fffffff);
+    set_cntv_tval_el0(interval);
 }
 
 void set_clock_handler(ClockHandler handler)
@@ -1,11 +1,29 @@
 #pragma once
 
 #include <common/defines.h>
+#include <aarch64/intrinsic.h>
 
 typedef void (*ClockHandler)(void);
 
+// kernel timing is in ticks of the generic timer counter (get_timestamp())
+static INLINE u64 ms_to_ticks(u64 ms)
+{
+    return ms * get_clock_frequency() / 1000;
+}
+
+static INLINE u64 us_to_ticks(u64 us)
+{
+    return us * get_clock_frequency() / 1000000;
+}
+
+static INLINE u64 ticks_to_us(u64 ticks)
+{
+    return ticks * 1000000 / get_clock_frequency();
+}
+
 WARN_RESULT u64 get_timestamp_ms();
 void init_clock();
-void reset_clock(u64 interval_ms);
+// raise the clock interrupt `interval` ticks from now
+void reset_clock(u64 interval);
 void set_clock_handler(ClockHandler handler);
 void invoke_clock_handler();
@@ -1,4 +1,5 @@
 #include <kernel/cpu.h>
+#include <aarch64/intrinsic.h>
 #include <common/defines.h>
 #include <driver/base.h>
 #include <driver/interrupt.h>
@@ -74,6 +75,11 @@ static inline void w_icc_eoir1_el1(u32 x)
     asm volatile("msr S3_0_C12_C12_1, %0" : : "r"(x));
 }
 
+static inline void w_icc_sgi1r_el1(u64 x)
+{
+    asm volatile("msr S3_0_C12_C11_5, %0" : : "r"(x));
+}
+
 static inline u32 icc_sre_el1()
 {
     u32 x;
@@ -248,6 +254,7 @@ void gicv3_init_percpu()
     gic_redist_init(cpu);
 
     gic_setup_ppi(cpuid(), TIMER_IRQ, 0);
+    gic_setup_ppi(cpuid(), RESCHED_SGI, 0);
 
     gic_enable();
 }
@@ -278,6 +285,14 @@ void gic_eoi(u32 iar)
     w_icc_eoir1_el1(iar);
 }
 
+// raise a Group 1 SGI on one CPU. the CPUs are aff0 0..NCPU-1 of cluster
+// 0, so the target list is a single bit
+void gic_send_sgi(u32 cpu, u32 intid)
+{
+    w_icc_sgi1r_el1(((u64)intid << 24) | (1u << cpu));
+    arch_isb();
+}
+
 static bool is_sgi_ppi(u32 id)
 {
     if (id < 32)
@@ -7,3 +7,4 @@ void gicv3_init_percpu(void);
 void gic_eoi(u32 iar);
 u32 gic_iar(void);
 bool gic_enabled(void);
+void gic_send_sgi(u32 cpu, u32 intid);
@@ -3,6 +3,7 @@
 #define NUM_IRQ_TYPES 64
 
 typedef enum {
+    RESCHED_SGI = 0,
     TIMER_IRQ = 27,
     UART_IRQ = 33,
     VIRTIO_BLK_IRQ = 48
@@ -48,6 +48,13 @@ static usize cachesize = 0;
 
 static LogHeader header; // in-memory copy of log header block.
 
+// blocks come out of this cache already initialized by `init_block`, and go
+// back into it with the sleep lock released.
+static struct kmem_cache *block_cache;
+
+static u64 shrink_blocks(u64 nr);
+static struct shrinker block_shrinker = {.shrink = shrink_blocks};
+
 /**
     @brief a struct to maintain other logging states.
     
@@ -73,6 +80,33 @@ struct {
 
 Block *find_cache(usize);
 void recently_used(Block *);
+// shrinker callback: drop up to `nr` blocks that nobody holds. unpinned
+// blocks are already on disk, so they can be read back at any time.
+static u64 shrink_blocks(u64 nr)
+{
+    u64 freed = 0;
+    if (!try_acquire_spinlock(&lock))
+        return 0;
+    _for_in_list(p, &head)
+    {
+        if (freed == nr)
+            break;
+        if (p == &head)
+            continue;
+        Block *b = container_of(p, Block, node);
+        if (!b->pinned && !b->acquired && b->ref == 0) {
+            ListNode *prev = p->prev;
+            _detach_from_list(p);
+            kmem_cache_free(block_cache, b);
+            cachesize--;
+            freed++;
+            p = prev;
+        }
+    }
+    release_spinlock(&lock);
+    return freed;
+}
+
 bool evict();
 void wblog();
 void create_checkpoint();
@@ -102,8 +136,9 @@ static INLINE void write_header()
 }
 
 // initialize a block struct.
-static void init_block(Block *block)
+static void init_block(void *_block)
 {
+    Block *block = _block;
     block->block_no = 0;
     init_list_node(&block->node);
     block->acquired = FALSE;
@@ -157,8 +192,13 @@ static Block *cache_acquire(usize block_no)
         evict();
     }
 
-    b = (Block *)kalloc(sizeof(Block));
-    init_block(b);
+    b = (Block *)kmem_cache_alloc(block_cache);
+    if (b == NULL) {
+        release_spinlock(&lock);
+        return NULL;
+    }
+    b->pinned = FALSE;
+    b->valid = FALSE;
     _get_sem(&b->lock);
     b->acquired = TRUE;
     b->block_no = block_no;
@@ -199,6 +239,13 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device)
     // TODO
     init_spinlock(&lock);
     init_list_node(&head);
+    // the tests init the cache again: create and register only once
+    if (!block_cache) {
+        block_cache = kmem_cache_create("block", sizeof(Block), CACHELINE_SIZE,
+                                        init_block);
+        ASSERT(block_cache);
+        register_shrinker(&block_shrinker);
+    }
 
     init_spinlock(&log.lock);
     init_sem(&log.end, 0);
@@ -408,7 +455,7 @@ bool evict()
         if (!b->pinned && !b->acquired && b->ref == 0) {
             ListNode *temp = p->prev;
             _detach_from_list(p);
-            kfree(b);
+            kmem_cache_free(block_cache, b);
             cachesize--;
             // try best to make cachesize below threshold
             ret = cachesize < EVICTION_THRESHOLD;
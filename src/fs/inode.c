@@ -1,3 +1,4 @@
+#include <common/rwlock.h>
 #include <common/string.h>
 #include <fs/inode.h>
 #include <kernel/mem.h>
@@ -28,8 +29,11 @@ static const BlockCache *cache;
     Use it to protect anything you need.
 
     e.g. the list of allocated blocks, ref counts, etc.
+
+    Most `inode_get` calls hit the cache and only read the list, so they
+    share the lock; everything that changes the list takes it exclusively.
  */
-static SpinLock lock;
+static RWLock lock;
 
 /**
     @brief the list of all allocated in-memory inodes.
@@ -42,6 +46,19 @@ static SpinLock lock;
  */
 static ListNode head;
 
+// backing store of the in-memory inodes.
+static struct kmem_cache *inode_cache;
+
+// constructor of inode_cache: the sleep lock survives across reuse, since
+// an inode is always unlocked before it is freed.
+static void inode_ctor(void *inode)
+{
+    init_sleeplock(&((Inode *)inode)->lock);
+}
+
+static u64 shrink_inodes(u64 nr);
+static struct shrinker inode_shrinker = {.shrink = shrink_inodes};
+
 Inode *find(usize inode_no);
 
 // return which block `inode_no` lives on.
@@ -65,8 +82,14 @@ static INLINE u32 *get_addrs(Block *block)
 // initialize inode tree.
 void init_inodes(const SuperBlock *_sblock, const BlockCache *_cache)
 {
-    init_spinlock(&lock);
+    init_rwlock(&lock);
     init_list_node(&head);
+    if (!inode_cache) {
+        inode_cache = kmem_cache_create("inode", sizeof(Inode), CACHELINE_SIZE,
+                                        inode_ctor);
+        ASSERT(inode_cache);
+        register_shrinker(&inode_shrinker);
+    }
     sblock = _sblock;
     cache = _cache;
 
@@ -80,7 +103,6 @@ void init_inodes(const SuperBlock *_sblock, const BlockCache *_cache)
 // initialize in-memory inode.
 static void init_inode(Inode *inode)
 {
-    init_sleeplock(&inode->lock);
     init_rc(&inode->rc);
     init_list_node(&inode->node);
     inode->inode_no = 0;
@@ -158,15 +180,28 @@ static Inode *inode_get(usize inode_no)
 {
     ASSERT(inode_no > 0);
     ASSERT(inode_no < sblock->num_inodes);
-    acquire_spinlock(&lock);
     // TODO
+    acquire_read_lock(&lock);
     Inode *ret = find(inode_no);
+    if (ret)
+        increment_rc(&ret->rc);
+    release_read_lock(&lock);
+    if (ret)
+        return ret;
+
+    acquire_write_lock(&lock);
+    // another CPU may have loaded it while the lock was dropped
+    ret = find(inode_no);
     if (ret) {
         increment_rc(&ret->rc);
-        release_spinlock(&lock);
+        release_write_lock(&lock);
         return ret;
     }
-    Inode *new_inode = (Inode *)kalloc(sizeof(Inode));
+    Inode *new_inode = (Inode *)kmem_cache_alloc(inode_cache);
+    if (new_inode == NULL) {
+        release_write_lock(&lock);
+        return NULL;
+    }
     init_inode(new_inode);
     new_inode->inode_no = inode_no;
     increment_rc(&new_inode->rc);
@@ -177,10 +212,36 @@ static Inode *inode_get(usize inode_no)
 
     new_inode->valid = TRUE;
     _insert_into_list(&head, &new_inode->node);
-    release_spinlock(&lock);
+    release_write_lock(&lock);
     return new_inode;
 }
 
+// shrinker callback: drop up to `nr` in-memory inodes without references.
+// their on-disk copy is up to date, so inode_get can load them again.
+static u64 shrink_inodes(u64 nr)
+{
+    u64 freed = 0;
+    if (!try_acquire_write_lock(&lock))
+        return 0;
+    _for_in_list(p, &head)
+    {
+        if (freed == nr)
+            break;
+        if (p == &head)
+            continue;
+        Inode *inode = container_of(p, Inode, node);
+        if (inode->rc.count == 0 && inode != inodes.root) {
+            ListNode *prev = p->prev;
+            _detach_from_list(p);
+            kmem_cache_free(inode_cache, inode);
+            freed++;
+            p = prev;
+        }
+    }
+    release_write_lock(&lock);
+    return freed;
+}
+
 Inode *find(usize inode_no)
 {
     _for_in_list(p, &head)
@@ -239,7 +300,7 @@ static Inode *inode_share(Inode *inode)
 static void inode_put(OpContext *ctx, Inode *inode)
 {
     // TODO
-    acquire_spinlock(&lock);
+    acquire_write_lock(&lock);
     if (inode->rc.count == 1 && inode->entry.num_links == 0) {
         inode_lock(inode);
         inode_clear(ctx, inode);
@@ -248,11 +309,11 @@ static void inode_put(OpContext *ctx, Inode *inode)
         inode_sync(ctx, inode, TRUE);
         inode_unlock(inode);
         _detach_from_list(&inode->node);
-        kfree(inode);
+        kmem_cache_free(inode_cache, inode);
     } else {
         decrement_rc(&inode->rc);
     }
-    release_spinlock(&lock);
+    release_write_lock(&lock);
 }
 
 static void inode_unlockput(OpContext *ctx, Inode *inode)
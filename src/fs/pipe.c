@@ -4,6 +4,18 @@
 #include <common/string.h>
 #include <kernel/printk.h>
 
+// wake every proc waiting on sem, like post_all_sem(). returns the last
+// one woken, or NULL
+static Proc *wake_all(Semaphore *sem)
+{
+    Proc *woken = NULL;
+    _lock_sem(sem);
+    while (_query_sem(sem) < 0)
+        woken = _post_sem(sem);
+    _unlock_sem(sem);
+    return woken;
+}
+
 void init_pipe(Pipe *pi)
 {
     /* (Final) TODO BEGIN */
@@ -119,8 +131,11 @@ int pipe_write(Pipe *pi, u64 addr, int n)
             len++;
         }
     }
-    post_all_sem(&pi->rlock);
+    Proc *woken = wake_all(&pi->rlock);
     release_spinlock(&pi->lock);
+    // let the reader take the data while it is hot, on our slice
+    if (woken)
+        yield_to(woken);
     return len;
     /* (Final) TODO END */
 }
@@ -148,8 +163,10 @@ int pipe_read(Pipe *pi, u64 addr, int n)
         len++;
         pi->nread++;
     }
-    post_all_sem(&pi->wlock);
+    Proc *woken = wake_all(&pi->wlock);
     release_spinlock(&pi->lock);
+    if (woken)
+        yield_to(woken);
     return len;
     /* (Final) TODO END */
 }
\ No newline at end of file
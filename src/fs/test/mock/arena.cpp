@@ -21,4 +21,32 @@ void kfree(void *object)
 {
     free(object);
 }
+
+struct kmem_cache {
+    usize size;
+    void (*ctor)(void *);
+};
+
+struct kmem_cache *kmem_cache_create(const char *, u64 size, u64,
+                                     void (*ctor)(void *))
+{
+    return new kmem_cache{size, ctor};
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    void *object = malloc(cache->size);
+    if (cache->ctor)
+        cache->ctor(object);
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache *, void *object)
+{
+    free(object);
+}
+
+void register_shrinker(struct shrinker *)
+{
+}
 }
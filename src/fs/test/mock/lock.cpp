@@ -21,6 +21,14 @@ struct Mutex {
         locked = true;
     }
 
+    bool try_lock()
+    {
+        if (!mutex.try_lock())
+            return false;
+        locked = true;
+        return true;
+    }
+
     void unlock()
     {
         locked = false;
@@ -79,6 +87,17 @@ void acquire_spinlock(struct SpinLock *lock)
     mtx_map[lock].lock();
 }
 
+bool try_acquire_spinlock(struct SpinLock *lock)
+{
+    if (holding++ == 0)
+        blocker.p();
+    if (mtx_map[lock].try_lock())
+        return true;
+    if (--holding == 0)
+        blocker.v();
+    return false;
+}
+
 void release_spinlock(struct SpinLock *lock)
 {
     mtx_map[lock].unlock();
@@ -86,12 +105,44 @@ void release_spinlock(struct SpinLock *lock)
         blocker.v();
 }
 
+// readers are exclusive too: the fs code never nests them
+void init_rwlock(struct RWLock *lock)
+{
+    init_spinlock((SpinLock *)lock, "");
+}
+
+void acquire_read_lock(struct RWLock *lock)
+{
+    acquire_spinlock((SpinLock *)lock);
+}
+
+void release_read_lock(struct RWLock *lock)
+{
+    release_spinlock((SpinLock *)lock);
+}
+
+bool try_acquire_write_lock(struct RWLock *lock)
+{
+    return try_acquire_spinlock((SpinLock *)lock);
+}
+
+void acquire_write_lock(struct RWLock *lock)
+{
+    acquire_spinlock((SpinLock *)lock);
+}
+
+void release_write_lock(struct RWLock *lock)
+{
+    release_spinlock((SpinLock *)lock);
+}
+
 bool holding_spinlock(struct SpinLock *lock)
 {
     return mtx_map[lock].locked;
 }
 
 struct Semaphore;
+struct Proc;
 #define sa(x) ((uint64_t *)x)[0]
 #define sb(x) ((uint64_t *)x)[1]
 void init_sem(Semaphore *x, int val)
@@ -121,9 +172,12 @@ int _query_sem(Semaphore *x)
 {
     return sb(x) - sa(x);
 }
-void _post_sem(Semaphore *x)
+// there are no procs here: any non-null pointer stands for the sleeper
+Proc *_post_sem(Semaphore *x)
 {
+    bool woken = sb(x) < sa(x);
     sb(x)++;
+    return woken ? reinterpret_cast<Proc *>(x) : nullptr;
 }
 bool _wait_sem(Semaphore *x, bool alertable [[maybe_unused]])
 {
@@ -87,6 +87,11 @@ void console_intr(char c)
     /* (Final) TODO BEGIN */
     acquire_spinlock(&cons.lock);
     switch (c) {
+#ifdef SPINLOCK_PROFILE
+    case C('L'): // dump the lock contention statistics
+        dump_lock_stats();
+        break;
+#endif
     case C('U'): // remove current line.
         while (cons.edit_idx != cons.write_idx &&
                cons.buf[(cons.edit_idx - 1) % INPUT_BUF] != '\n') {
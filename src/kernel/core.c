@@ -21,10 +21,17 @@ NO_RETURN void idle_entry()
 {
     set_cpu_on();
     // kalloc_test();
+    // timer_test();
     while (1) {
         yield();
         if (panic_flag)
             break;
+        // nothing to run: spend the time zeroing pages for later faults,
+        // and only sleep once the pool is full
+        if (refill_zero_pool())
+            continue;
+        // no tick runs while idle. wfi returns on our next timer, or on the
+        // resched IPI sent when a proc becomes runnable for us
         arch_with_trap
         {
             arch_wfi();
@@ -50,6 +57,7 @@ void kernel_entry()
     init_filesystem();
 
     printk("Hello world! (Core %lld)\n", cpuid());
+    // sem_test();
 
     /**
      * (Final) TODO BEGIN 
@@ -57,18 +65,22 @@ void kernel_entry()
      * Map init.S to user space and trap_return to run icode.
      */
     initproc = create_proc();
+    ASSERT(initproc);
     initproc->ucontext->elr = INIT_ELR;
     initproc->ucontext->sp = INIT_SP;
     initproc->ucontext->spsr = 0;
 
-    struct section *text = (struct section *)kalloc(sizeof(struct section));
+    struct section *text = kmem_cache_alloc(section_cache);
+    ASSERT(text);
     text->flags = ST_TEXT;
     text->begin = INIT_ELR;
     text->end = text->begin + (u64)eicode - (u64)icode;
     _insert_into_list(&initproc->pgdir.section_head, &text->stnode);
     void *p = kalloc_page();
+    ASSERT(p);
     memcpy(p, (void *)icode, PAGE_SIZE);
-    vmmap(&initproc->pgdir, INIT_ELR, p, PTE_USER_DATA | PTE_RO);
+    bool mapped = vmmap(&initproc->pgdir, INIT_ELR, p, PTE_USER_DATA | PTE_RO) == 0;
+    ASSERT(mapped);
 
     start_proc(initproc, trap_return, 0);
     // printk("initproc start!\n");
@@ -8,75 +8,219 @@
 
 struct cpu cpus[NCPU];
 
-static bool __timer_cmp(rb_node lnode, rb_node rnode)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+static INLINE int level_shift(int level)
 {
-    i64 d = container_of(lnode, struct timer, _node)->_key -
-            container_of(rnode, struct timer, _node)->_key;
-    if (d < 0)
-        return true;
-    if (d == 0)
-        return lnode < rnode;
-    return false;
+    return level * WHEEL_BITS;
 }
 
-static void __timer_set_clock()
+// wheel units are rounded up, so that no timer fires before its deadline
+static INLINE u64 wheel_unit(u64 ticks)
 {
-    auto node = _rb_first(&cpus[cpuid()].timer);
-    if (!node) {
-        reset_clock(10);
+    return (ticks + (1ull << WHEEL_TICK_SHIFT) - 1) >> WHEEL_TICK_SHIFT;
+}
+
+static void wheel_add(struct timer_wheel *w, struct timer *t)
+{
+    // a deadline already passed is taken at the next expiry
+    u64 key = MAX(wheel_unit(t->_key), w->clk);
+    int l = 0;
+    while (l < WHEEL_LEVELS &&
+           (key ^ w->clk) >> level_shift(l + 1) != 0)
+        l++;
+    if (l == WHEEL_LEVELS) {
+        _insert_into_list(w->overflow.prev, &t->_node);
+        t->_level = WHEEL_LEVELS;
+    } else {
+        int i = (key >> level_shift(l)) & WHEEL_MASK;
+        _insert_into_list(w->slot[l][i].prev, &t->_node);
+        w->pending[l] |= 1ull << i;
+        t->_level = l;
+        t->_slot = i;
+    }
+}
+
+static void wheel_del(struct timer_wheel *w, struct timer *t)
+{
+    _detach_from_list(&t->_node);
+    int l = t->_level;
+    if (l < WHEEL_LEVELS && _empty_list(&w->slot[l][t->_slot]))
+        w->pending[l] &= ~(1ull << t->_slot);
+}
+
+// put the timers of a list back on the wheel relative to the current clk
+static void wheel_readd(struct timer_wheel *w, ListNode *list)
+{
+    // move them to a local head first: overflow timers may go back to list
+    ListNode head;
+    _insert_into_list(list, &head);
+    _detach_from_list(list);
+    while (!_empty_list(&head)) {
+        struct timer *t = container_of(head.next, struct timer, _node);
+        _detach_from_list(&t->_node);
+        wheel_add(w, t);
+    }
+}
+
+/**
+ * the earliest unit at which the wheel has work: the deadline of the first
+ * level-0 timer, or the start of the first slot to cascade. the current slot
+ * of a level above 0 is always empty, so the result is after clk unless a
+ * level-0 timer is due at clk. ~0 if there is no timer.
+ */
+static u64 wheel_next(struct timer_wheel *w)
+{
+    u64 next = ~0ull;
+    for (int l = 0; l != WHEEL_LEVELS; l++) {
+        u64 base = w->clk >> level_shift(l);
+        u64 bits = w->pending[l] & (~0ull << (base & WHEEL_MASK));
+        if (bits) {
+            u64 slot = (base & ~(u64)WHEEL_MASK) + __builtin_ctzll(bits);
+            next = MIN(next, slot << level_shift(l));
+        }
+    }
+    if (!_empty_list(&w->overflow)) {
+        u64 span = level_shift(WHEEL_LEVELS);
+        next = MIN(next, ((w->clk >> span) + 1) << span);
+    }
+    return next;
+}
+
+// move clk forward to `to`, which must not be past wheel_next(), and
+// cascade the slots that start there
+static void wheel_forward(struct timer_wheel *w, u64 to)
+{
+    w->clk = to;
+    for (int l = 1; l != WHEEL_LEVELS; l++) {
+        if (to & ((1ull << level_shift(l)) - 1))
+            return;
+        int i = (to >> level_shift(l)) & WHEEL_MASK;
+        w->pending[l] &= ~(1ull << i);
+        wheel_readd(w, &w->slot[l][i]);
+    }
+    if (!(to & ((1ull << level_shift(WHEEL_LEVELS)) - 1)))
+        wheel_readd(w, &w->overflow);
+}
+
+// take one timer due at or before `now` (in wheel units) off the wheel, or NULL. empty
+// stretches are skipped in one step, so this is cheap after a long idle
+static struct timer *wheel_pop(struct timer_wheel *w, u64 now)
+{
+    while (w->clk <= now) {
+        int i = w->clk & WHEEL_MASK;
+        if (!_empty_list(&w->slot[0][i])) {
+            auto t = container_of(w->slot[0][i].next, struct timer, _node);
+            wheel_del(w, t);
+            w->nr_timers--;
+            return t;
+        }
+        wheel_forward(w, MIN(wheel_next(w), now + 1));
+    }
+    return NULL;
+}
+
+// longest interval the clock takes: its compare value is a signed 32-bit
+// count. later deadlines just take a detour through timer_clock_handler
+#define MAX_CLOCK_INTERVAL 0x7fffffff
+
+// program the clock for the earliest work on this CPU's wheel, or switch it
+// off when there is none, so that an idle CPU is not woken for nothing.
+// call with w->lock
+static void __timer_set_clock(struct timer_wheel *w)
+{
+    if (!w->nr_timers) {
+        disable_timer();
         return;
     }
-    auto t1 = container_of(node, struct timer, _node)->_key;
-    auto t0 = get_timestamp_ms();
+    enable_timer();
+    u64 t1 = wheel_next(w) << WHEEL_TICK_SHIFT;
+    u64 t0 = get_timestamp();
     if (t1 <= t0)
         reset_clock(0);
     else
-        reset_clock(t1 - t0);
+        reset_clock(MIN(t1 - t0, (u64)MAX_CLOCK_INTERVAL));
 }
 
 static void timer_clock_handler()
 {
-    reset_clock(10);
+    struct timer_wheel *w = &cpus[cpuid()].timer;
+    cpus[cpuid()].nr_timer_irqs++;
+    // a handler may switch to another proc, so keep no state across it
     while (1) {
-        auto node = _rb_first(&cpus[cpuid()].timer);
-        if (!node)
+        acquire_spinlock(&w->lock);
+        auto timer = wheel_pop(w, get_timestamp() >> WHEEL_TICK_SHIFT);
+        if (timer)
+            timer->triggered = true;
+        release_spinlock(&w->lock);
+        if (!timer)
             break;
-        auto timer = container_of(node, struct timer, _node);
-        if (get_timestamp_ms() < timer->_key)
-            break;
-        cancel_cpu_timer(timer);
-        timer->triggered = true;
         timer->handler(timer);
     }
+    acquire_spinlock(&w->lock);
+    __timer_set_clock(w);
+    release_spinlock(&w->lock);
 }
 
 void init_clock_handler()
 {
+    for (int c = 0; c != NCPU; c++) {
+        struct timer_wheel *w = &cpus[c].timer;
+        init_spinlock(&w->lock);
+        for (int l = 0; l != WHEEL_LEVELS; l++)
+            for (int i = 0; i != WHEEL_SIZE; i++)
+                init_list_node(&w->slot[l][i]);
+        init_list_node(&w->overflow);
+    }
     set_clock_handler(&timer_clock_handler);
 }
 
-static struct timer hello_timer[4];
-
-static void hello(struct timer *t)
+/**
+ * the deadline to use for a timer due at `key` that may fire as late as
+ * key + slack: clear the low bits of the latest deadline up to the highest
+ * bit where the two differ. timers with overlapping windows tend to land on
+ * the same rounded deadline, and so on one interrupt.
+ */
+static u64 apply_slack(u64 key, u64 slack)
 {
-    // printk("CPU %lld: living\n", cpuid());
-    t->data++;
-    set_cpu_timer(&hello_timer[cpuid()]);
+    if (!slack)
+        return key;
+    u64 limit = key + slack;
+    int bit = 63 - __builtin_clzll(key ^ limit);
+    return limit & ~((1ull << bit) - 1);
 }
 
 void set_cpu_timer(struct timer *timer)
 {
+    struct timer_wheel *w = &cpus[cpuid()].timer;
+    u64 now = get_timestamp();
+    acquire_spinlock(&w->lock);
+    // an empty wheel may skip ahead, keeping new timers on low levels
+    if (!w->nr_timers)
+        w->clk = MAX(w->clk, now >> WHEEL_TICK_SHIFT);
     timer->triggered = false;
-    timer->_key = get_timestamp_ms() + timer->elapse;
-    ASSERT(0 == _rb_insert(&timer->_node, &cpus[cpuid()].timer, __timer_cmp));
-    __timer_set_clock();
+    timer->_key = apply_slack(now + timer->elapse, timer->slack);
+    timer->_cpu = cpuid();
+    wheel_add(w, timer);
+    w->nr_timers++;
+    __timer_set_clock(w);
+    release_spinlock(&w->lock);
 }
 
-void cancel_cpu_timer(struct timer *timer)
+bool cancel_cpu_timer(struct timer *timer)
 {
-    ASSERT(!timer->triggered);
-    _rb_erase(&timer->_node, &cpus[cpuid()].timer);
-    __timer_set_clock();
+    struct timer_wheel *w = &cpus[timer->_cpu].timer;
+    acquire_spinlock(&w->lock);
+    bool pending = !timer->triggered;
+    if (pending) {
+        wheel_del(w, timer);
+        w->nr_timers--;
+        // another CPU's clock is left alone: at worst it fires for nothing
+        if (timer->_cpu == cpuid())
+            __timer_set_clock(w);
+    }
+    release_spinlock(&w->lock);
+    return pending;
 }
 
 void set_cpu_on()
@@ -90,9 +234,6 @@ void set_cpu_on()
     init_clock();
     cpus[cpuid()].online = true;
     printk("CPU %lld: hello\n", cpuid());
-    hello_timer[cpuid()].elapse = 5000;
-    hello_timer[cpuid()].handler = hello;
-    set_cpu_timer(&hello_timer[cpuid()]);
 }
 
 void set_cpu_off()
@@ -2,28 +2,96 @@
 
 #include <kernel/proc.h>
 #include <common/rbtree.h>
+#include <common/spinlock.h>
 
 #define NCPU 4
 
+#define RT_PRIO_MAX 99
+
 struct sched {
     // TODO: customize your sched info
     Proc* thisproc;
     Proc* idle; 
+
+    // the run queue of this CPU. the lock also protects the state of every
+    // proc whose schinfo.cpu is this CPU
+    SpinLock lock;
+    struct rb_root_ rq;
+    int nr_running; // procs in rq, not counting thisproc
+    u64 min_vruntime; // never decreases; floor for procs joining rq
+
+    // real-time procs, one FIFO list per priority. consulted before rq
+    ListNode rt_queue[RT_PRIO_MAX + 1];
+    u64 rt_bitmap[2]; // bit i set: rt_queue[i] is not empty
+    int nr_rt;
+    u64 rt_period_start; // RT procs may run rt_time out of every period
+    u64 rt_time;
+
+    // runnable procs whose affinity excludes this CPU, waiting to be moved
+    ListNode migrate_list;
+    int nr_migrating;
+
+    // a proc woken here should preempt thisproc at the next trap return
+    bool need_resched;
+    // thisproc ran alone and got the LONE_TIMESLICE tick
+    bool lone_tick;
+    // a proc was queued behind the lone tick: bring it in to TIMESLICE
+    bool retick;
+    // the last proc this CPU woke onto its own queue, while it stays queued
+    Proc *woken;
+    // run this proc next, on the rest of the current slice. see yield_to()
+    Proc *handoff;
+};
+
+/**
+ * hierarchical timing wheel. its unit is 2^WHEEL_TICK_SHIFT counter ticks
+ * (16 us at 62.5 MHz), and deadlines are rounded up to it. level l has
+ * WHEEL_SIZE slots of WHEEL_SIZE^l units each; a timer sits on the lowest
+ * level whose current WHEEL_SIZE-slot span holds its deadline, and moves
+ * down a level (cascades) when the clock reaches its slot. deadlines beyond
+ * the top level wait on `overflow`.
+ */
+#define WHEEL_TICK_SHIFT 10
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+struct timer_wheel {
+    // timers are set on their own CPU, but may be cancelled from any
+    SpinLock lock;
+    u64 clk; // every timer due before clk has been taken off the wheel
+    int nr_timers;
+    u64 pending[WHEEL_LEVELS]; // bit i set: slot[l][i] is not empty
+    ListNode slot[WHEEL_LEVELS][WHEEL_SIZE];
+    ListNode overflow;
 };
 
 struct cpu {
     bool online;
-    struct rb_root_ timer;
+    struct timer_wheel timer;
     struct sched sched;
+
+    // statistics, times in timer counter ticks. only this CPU updates them
+    u64 busy_time;
+    u64 idle_time;
+    u64 nr_switches;
+    u64 wait_hist[SCHEDSTAT_NBUCKET];
+    u64 nr_timer_irqs;
 };
 
 extern struct cpu cpus[NCPU];
 
 struct timer {
     bool triggered;
-    int elapse;
+    u64 elapse; // in timer counter ticks, see ms_to_ticks()
+    // how many ticks late the timer may fire. its deadline is rounded up
+    // within the slack so that timers due around the same time share one
+    // clock interrupt
+    u64 slack;
     u64 _key;
-    struct rb_node_ _node;
+    usize _cpu;
+    ListNode _node;
+    u8 _level, _slot; // where _node is on the wheel
     void (*handler)(struct timer *);
     u64 data;
 };
@@ -34,4 +102,5 @@ void set_cpu_on();
 void set_cpu_off();
 
 void set_cpu_timer(struct timer *timer);
-void cancel_cpu_timer(struct timer *timer);
\ No newline at end of file
+// false if the timer already fired. may be called from any CPU
+bool cancel_cpu_timer(struct timer *timer);
\ No newline at end of file
@@ -20,6 +20,17 @@
 
 extern int fdalloc(struct file *f);
 
+// map a new zeroed page at va, or return NULL if memory is exhausted
+static void *map_new_page(struct pgdir *pgdir, u64 va)
+{
+    void *p = kalloc_zeroed_page();
+    if (p && vmmap(pgdir, va, p, PTE_USER_DATA | PTE_RW) < 0) {
+        kfree_page(p);
+        return NULL;
+    }
+    return p;
+}
+
 int execve(const char *path, char *const argv[], char *const envp[])
 {
     /* (Final) TODO BEGIN */
@@ -71,6 +82,8 @@ int execve(const char *path, char *const argv[], char *const envp[])
     Elf64_Half e_phnum = elf.e_phnum;
 
     pgdir = (struct pgdir *)kalloc(sizeof(struct pgdir));
+    if (pgdir == NULL)
+        goto nomem;
     init_pgdir(pgdir);
 
     /*
@@ -103,7 +116,9 @@ int execve(const char *path, char *const argv[], char *const envp[])
         section_top = MAX(section_top, phdr.p_vaddr + phdr.p_memsz);
 
         // section
-        struct section *sec = (struct section *)kalloc(sizeof(struct section));
+        struct section *sec = kmem_cache_alloc(section_cache);
+        if (sec == NULL)
+            goto nomem;
         init_section(sec);
         sec->begin = phdr.p_vaddr;
 
@@ -141,9 +156,9 @@ int execve(const char *path, char *const argv[], char *const envp[])
                 u64 cursize = MIN(filesz, (u64)PAGE_SIZE - VA_OFFSET(va));
                 // printk("va: %llx, cursize: %lld, filesize: %lld\n", va, cursize,
                 //    filesz);
-                void *p = kalloc_page();
-                memset(p, 0, PAGE_SIZE);
-                vmmap(pgdir, PAGE_BASE(va), p, PTE_USER_DATA | PTE_RW);
+                void *p = map_new_page(pgdir, PAGE_BASE(va));
+                if (p == NULL)
+                    goto nomem;
                 if (inodes.read(ip, (u8 *)(p + VA_OFFSET(va)), offset,
                                 cursize) != cursize) {
                     error;
@@ -168,8 +183,9 @@ int execve(const char *path, char *const argv[], char *const envp[])
                          va; // size of the rest of bss section
                 while (filesz > 0) {
                     u64 cursize = MIN((u64)PAGE_SIZE, filesz);
-                    vmmap(pgdir, PAGE_BASE(va), get_zero_page(),
-                          PTE_USER_DATA | PTE_RO);
+                    if (vmmap(pgdir, PAGE_BASE(va), get_zero_page(),
+                              PTE_USER_DATA | PTE_RO) < 0)
+                        goto nomem;
                     filesz -= cursize;
                     va += cursize;
                 }
@@ -187,9 +203,12 @@ int execve(const char *path, char *const argv[], char *const envp[])
 
     inodes.unlockput(&ctx, ip);
     bcache.end_op(&ctx);
+    ip = NULL;
 
     // init the heap section
-    struct section *heap = (struct section *)kalloc(sizeof(struct section));
+    struct section *heap = kmem_cache_alloc(section_cache);
+    if (heap == NULL)
+        goto nomem;
     memset(heap, 0, sizeof(struct section));
     heap->begin = heap->end = PAGE_BASE(section_top) + PAGE_SIZE;
     heap->flags = ST_HEAP;
@@ -251,13 +270,13 @@ int execve(const char *path, char *const argv[], char *const envp[])
     */
 
     for (u64 i = 1; i <= USER_STACK_SIZE / PAGE_SIZE; i++) {
-        void *p = kalloc_page();
-        memset(p, 0, PAGE_SIZE);
-        vmmap(pgdir, USER_STACK_TOP - i * PAGE_SIZE, p, PTE_USER_DATA | PTE_RW);
+        if (map_new_page(pgdir, USER_STACK_TOP - i * PAGE_SIZE) == NULL)
+            goto nomem;
     }
     u64 top = USER_STACK_TOP - RESERVE_SIZE;
-    struct section *st_ustack =
-            (struct section *)kalloc(sizeof(struct section));
+    struct section *st_ustack = kmem_cache_alloc(section_cache);
+    if (st_ustack == NULL)
+        goto nomem;
     memset(st_ustack, 0, sizeof(struct section));
     st_ustack->begin = USER_STACK_TOP - USER_STACK_SIZE;
     st_ustack->end = USER_STACK_TOP;
@@ -294,27 +313,32 @@ int execve(const char *path, char *const argv[], char *const envp[])
     }
     u64 argv_start = argc_start + 8;
     u64 sp = argc_start;
-    copyout(pgdir, (void *)sp, &argc, 8);
+    if (copyout(pgdir, (void *)sp, &argc, 8) < 0)
+        goto nomem;
 
     // copy strings of argv & envp and argv & envp
     for (u64 i = 0; i < argc; i++) {
         usize len = strlen(argv[i]) + 1;
-        copyout(pgdir, (void *)str_start, argv[i], len);
-        copyout(pgdir, (void *)argv_start, &str_start, 8);
+        if (copyout(pgdir, (void *)str_start, argv[i], len) < 0 ||
+            copyout(pgdir, (void *)argv_start, &str_start, 8) < 0)
+            goto nomem;
         str_start += len;
         argv_start += 8;
     }
-    copyout(pgdir, (void *)argv_start, &zero, 8); // argv[n] = 0
+    if (copyout(pgdir, (void *)argv_start, &zero, 8) < 0) // argv[n] = 0
+        goto nomem;
 
     argv_start += 8;
     for (u64 i = 0; i < envc; i++) {
         usize len = strlen(envp[i]) + 1;
-        copyout(pgdir, (void *)str_start, envp[i], len);
-        copyout(pgdir, (void *)argv_start, &str_start, 8);
+        if (copyout(pgdir, (void *)str_start, envp[i], len) < 0 ||
+            copyout(pgdir, (void *)argv_start, &str_start, 8) < 0)
+            goto nomem;
         str_start += len;
         argv_start += 8;
     }
-    copyout(pgdir, (void *)argv_start, &zero, 8); // envp[m] = 0
+    if (copyout(pgdir, (void *)argv_start, &zero, 8) < 0) // envp[m] = 0
+        goto nomem;
 
     curproc->ucontext->sp = sp;
 
@@ -329,9 +353,14 @@ int execve(const char *path, char *const argv[], char *const envp[])
     attach_pgdir(&curproc->pgdir);
     return 0;
 
+nomem:
+    error;
+    printk("exec: out of memory\n");
 bad:
     if (pgdir) {
+        free_sections(pgdir);
         free_pgdir(pgdir);
+        kfree(pgdir);
     }
     if (ip) {
         inodes.unlockput(&ctx, ip);
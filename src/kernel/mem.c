@@ -5,11 +5,47 @@
 #include <driver/memlayout.h>
 #include <kernel/mem.h>
 #include <kernel/printk.h>
+#include <kernel/cpu.h>
 #include <common/list.h>
+#include <kernel/memstat.h>
+#include <driver/clock.h>
 
 #define KERNELSTOP P2K(PHYSTOP)
 
+#define PAGE_ADDR(index) ((void *)(P2K(EXTMEM) + (u64)(index) * PAGE_SIZE))
+
+// per-CPU page cache: refilled from / drained to the buddy allocator in batches
+#define PAGE_CACHE_SIZE 64
+#define PAGE_CACHE_BATCH 32
+
+// per-CPU pool of pre-zeroed pages, topped up from the idle loop
+#define ZERO_POOL_SIZE 32
+#define ZERO_POOL_BATCH 4 // pages zeroed per idle loop iteration
+#define ZERO_POOL_MIN_FREE 256 // stop pre-zeroing below this many free pages
+
+// objects each shrinker is asked to drop when the allocator runs dry
+#define SHRINK_BATCH 64
+
+// per-CPU object magazines in front of every slab cache
+#define KMALLOC_MAX_SLAB 2048 // larger kalloc requests get whole page runs
+#define NSLAB (KMALLOC_MAX_SLAB / 8) // kmalloc caches, one per 8 bytes
+#define SLAB_MAGAZINE_SIZE 16
+#define SLAB_MAGAZINE_BATCH 8
+
 RefCount kalloc_page_cnt;
+static isize peak_page_cnt;
+
+// allocator event counters, bumped by each CPU on its own slot
+struct mem_events {
+    u64 page_allocs, page_frees;
+    u64 obj_allocs, obj_frees;
+};
+
+static struct mem_events mem_events[NCPU];
+
+_Static_assert(MEMSTAT_NCPU == NCPU, "memstat.h is out of sync");
+_Static_assert(MEMSTAT_NORDER == BUDDY_MAX_ORDER + 1,
+               "memstat.h is out of sync");
 
 SpinLock lock1, lock2;
 
@@ -17,63 +53,144 @@ extern char end[];
 static void *zero_page;
 struct page pages[ALL_PAGE_COUNT];
 
-ListNode *free_pages = NULL;
+/**
+ * buddy allocator: free_area[k] lists free blocks of 2^k pages. The list node
+ * lives in the first bytes of the free block itself, and the head page of
+ * every free block is tagged with PG_BUDDY and its order in `pages[]`.
+ */
+struct free_area {
+    ListNode head;
+    u64 nr_free;
+};
+
+static struct free_area free_area[BUDDY_MAX_ORDER + 1];
+static u64 first_page, last_page; // allocatable page index range [first, last)
+
+struct page_cache {
+    int count;
+    void *pages[PAGE_CACHE_SIZE];
+};
+
+// only touched by its own CPU with traps disabled, so no lock is needed
+static struct page_cache page_cache[NCPU];
+
+// kalloc_test turns this off to measure the buddy allocator alone
+bool page_cache_enabled = true;
+
+struct zero_pool {
+    int count;
+    void *pages[ZERO_POOL_SIZE];
+};
+
+// like page_cache, owned by its CPU and touched with traps disabled
+static struct zero_pool zero_pool[NCPU];
 
 typedef struct slab {
     struct slab *next;
 } slab;
 
-slab *slabs[512];
-
-void new_slab(u64 index)
-{
-    u64 size = (index + 1) * 8;
-    slab *new_slab = (slab *)kalloc_page();
-    int *idx = (int *)new_slab;
-    *idx = index;
-    new_slab = (slab *)((u64)new_slab + 8);
-    slab *s = new_slab;
-    int free_count = 1;
-    while (1) {
-        u64 addr = (u64)s;
-        if (addr + 2 * size > (u64)new_slab + PAGE_SIZE - 8) {
-            s->next = NULL;
-            break;
-        }
-        s->next = (slab *)(addr + size);
-        s = s->next;
-        free_count += 1;
-    }
-    *(idx + 1) = free_count;
-    slabs[index] = new_slab;
+/**
+ * every slab page starts with this header and carries its own freelist.
+ * the page sits on exactly one of its cache's partial/full/empty lists,
+ * so both picking a page to allocate from and releasing a free page are
+ * constant time.
+ */
+struct slab_page {
+    ListNode node;
+    slab *freelist;
+    struct kmem_cache *cache;
+    u16 inuse;
+    u16 total;
+};
+
+#define SLAB_MAX_EMPTY 1 // empty pages each cache keeps before releasing
+
+struct slab_magazine {
+    int count;
+    void *objs[SLAB_MAGAZINE_SIZE];
+};
+
+struct kmem_cache {
+    const char *name;
+    u64 size; // object size requested by the creator
+    u64 stride; // distance between two objects in a slab page
+    u64 offset; // where the first object starts in a slab page
+    u64 link; // where the freelist link lives inside a free object
+    void (*ctor)(void *);
+    ListNode cache_node; // on cache_list
+
+    SpinLock lock; // protects the page lists below
+    ListNode partial, full, empty;
+    int nr_empty;
+
+    // like page_cache, each CPU owns its magazine and touches it with traps
+    // disabled
+    struct slab_magazine magazine[NCPU];
+};
+
+// kalloc(size) is served by the kmalloc cache of 8-byte granularity
+static struct kmem_cache kmalloc_caches[NSLAB];
+
+// lock2 protects the list of every cache, kmalloc caches included, and the
+// list of shrinkers
+static ListNode cache_list;
+static ListNode shrinker_list;
+
+// kalloc_test turns this off to measure the shared slab lists alone
+bool slab_magazine_enabled = true;
+
+static void kmem_cache_init(struct kmem_cache *c, const char *name, u64 size,
+                            u64 align, void (*ctor)(void *));
+
+// call with lock1
+static void add_free_block(u64 index, int order)
+{
+    set_page_flag(&pages[index], PG_BUDDY);
+    pages[index].order = order;
+    _insert_into_list(&free_area[order].head, (ListNode *)PAGE_ADDR(index));
+    free_area[order].nr_free++;
 }
 
-void *fetch_slab(u64 size)
+// call with lock1
+static void del_free_block(u64 index, int order)
 {
-    u64 index = size % 8 ? (size / 8) : ((size / 8) - 1);
-    slab *ret = NULL;
-    if (slabs[index] == NULL) {
-        new_slab(index);
-        ret = slabs[index];
-        u64 page = (u64)ret & ~4095;
-        int *free_count = (int *)(page + 4);
-        *free_count -= 1;
-        slabs[index] = slabs[index]->next;
-    } else {
-        ret = slabs[index];
-        u64 page_addr = (u64)ret & ~4095;
-        int *free_count = (int *)(page_addr + 4);
-        *free_count -= 1;
-        slabs[index] = slabs[index]->next;
+    clear_page_flag(&pages[index], PG_BUDDY);
+    _detach_from_list((ListNode *)PAGE_ADDR(index));
+    free_area[order].nr_free--;
+}
+
+// call with lock1
+static void *buddy_alloc(int order)
+{
+    int k = order;
+    while (k <= BUDDY_MAX_ORDER && _empty_list(&free_area[k].head))
+        k++;
+    if (k > BUDDY_MAX_ORDER)
+        return NULL;
+    u64 index = PAGE_INDEX(free_area[k].head.next);
+    del_free_block(index, k);
+    // split, handing the upper halves back to the lower orders
+    while (k > order) {
+        k--;
+        add_free_block(index + (1ull << k), k);
     }
-    return (void *)ret;
+    pages[index].order = order;
+    return PAGE_ADDR(index);
 }
 
-void free_slab(slab *s, int index)
+// call with lock1
+static void buddy_free(u64 index, int order)
 {
-    slab *head = slabs[index];
-    s->next = head;
-    slabs[index] = s;
+    while (order < BUDDY_MAX_ORDER) {
+        u64 buddy = index ^ (1ull << order);
+        if (buddy < first_page || buddy >= last_page ||
+            !test_page_flag(&pages[buddy], PG_BUDDY) || (int)pages[buddy].order != order)
+            break;
+        del_free_block(buddy, order);
+        index = MIN(index, buddy);
+        order++;
+    }
+    add_free_block(index, order);
 }
 
 void kinit()
@@ -85,20 +202,28 @@ void kinit()
     u64 addr = (u64)end;
     zero_page = (void *)(PAGE_BASE(addr) + PAGE_SIZE);
     memset(zero_page, 0, PAGE_SIZE);
-    free_pages = (ListNode *)(zero_page + PAGE_SIZE);
-    ListNode *cur = free_pages;
-    while (1) {
-        if ((((u64)cur) + PAGE_SIZE) == KERNELSTOP) {
-            cur->next = NULL;
-            break;
-        }
-        ListNode *next = (ListNode *)(((u64)cur) + PAGE_SIZE);
-        cur->next = next;
-        next->prev = cur;
-        cur = next;
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++) {
+        init_list_node(&free_area[i].head);
+        free_area[i].nr_free = 0;
     }
-    for (int i = 0; i != 512; i++) {
-        slabs[i] = NULL;
+    first_page = PAGE_INDEX(zero_page + PAGE_SIZE);
+    last_page = PAGE_INDEX(KERNELSTOP);
+    // carve the free range into maximal aligned blocks
+    for (u64 i = first_page; i < last_page;) {
+        int order = BUDDY_MAX_ORDER;
+        while ((i & ((1ull << order) - 1)) || i + (1ull << order) > last_page)
+            order--;
+        add_free_block(i, order);
+        i += 1ull << order;
+    }
+    for (int i = 0; i != NCPU; i++) {
+        page_cache[i].count = 0;
+        zero_pool[i].count = 0;
+    }
+    init_list_node(&cache_list);
+    init_list_node(&shrinker_list);
+    for (int i = 0; i != NSLAB; i++) {
+        kmem_cache_init(&kmalloc_caches[i], "kmalloc", (i + 1) * 8, 8, NULL);
     }
     for (int i = 0; i != ALL_PAGE_COUNT; i++) {
         if (pages[i].ref.count) {
@@ -107,81 +232,430 @@ void kinit()
     }
 }
 
-void *kalloc_page()
+// pop at most n pages from the buddy allocator into buf
+static int fetch_free_pages(void **buf, int n)
 {
-    increment_rc(&kalloc_page_cnt);
+    int cnt = 0;
     acquire_spinlock(&lock1);
-    void *ret = (void *)(free_pages);
-    if (ret == NULL) {
-        PANIC();
+    while (cnt < n) {
+        void *p = buddy_alloc(0);
+        if (p == NULL)
+            break;
+        buf[cnt++] = p;
     }
-    free_pages = free_pages->next;
     release_spinlock(&lock1);
+    return cnt;
+}
+
+// give n pages in buf back to the buddy allocator
+static void put_free_pages(void **buf, int n)
+{
+    acquire_spinlock(&lock1);
+    for (int i = 0; i < n; i++)
+        buddy_free(PAGE_INDEX(buf[i]), 0);
+    release_spinlock(&lock1);
+}
+
+static void update_peak()
+{
+    isize cnt = __atomic_load_n(&kalloc_page_cnt.count, __ATOMIC_RELAXED);
+    isize peak = __atomic_load_n(&peak_page_cnt, __ATOMIC_RELAXED);
+    while (cnt > peak &&
+           !__atomic_compare_exchange_n(&peak_page_cnt, &peak, cnt, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void register_shrinker(struct shrinker *s)
+{
+    acquire_spinlock(&lock2);
+    _insert_into_list(&shrinker_list, &s->node);
+    release_spinlock(&lock2);
+}
+
+/**
+ * called when the buddy allocator cannot satisfy a request. hand back the
+ * pages that are only kept for speed (this CPU's pre-zeroed pages and the
+ * empty slab pages of every cache), then ask the shrinkers to drop cached
+ * objects. last, this CPU's page cache goes back to the buddy allocator,
+ * so that its pages can merge into the higher orders kalloc_pages needs.
+ * other CPUs own their caches and keep them. the caller simply retries.
+ *
+ * cache locks are only tried: the caller may be allocating while holding
+ * one of them.
+ */
+static void reclaim_memory()
+{
+    struct zero_pool *zp = &zero_pool[cpuid()];
+    while (zp->count)
+        kfree_page(zp->pages[--zp->count]);
+    acquire_spinlock(&lock2);
+    _for_in_list(p, &cache_list)
+    {
+        if (p == &cache_list)
+            continue;
+        struct kmem_cache *c = container_of(p, struct kmem_cache, cache_node);
+        if (!try_acquire_spinlock(&c->lock))
+            continue;
+        while (!_empty_list(&c->empty)) {
+            ListNode *node = c->empty.next;
+            _detach_from_list(node);
+            kfree_page(container_of(node, struct slab_page, node));
+        }
+        c->nr_empty = 0;
+        release_spinlock(&c->lock);
+    }
+    _for_in_list(p, &shrinker_list)
+    {
+        if (p == &shrinker_list)
+            continue;
+        container_of(p, struct shrinker, node)->shrink(SHRINK_BATCH);
+    }
+    release_spinlock(&lock2);
+    struct page_cache *pc = &page_cache[cpuid()];
+    put_free_pages(pc->pages, pc->count);
+    pc->count = 0;
+}
+
+static void *take_free_page()
+{
+    void *ret = NULL;
+    if (page_cache_enabled) {
+        struct page_cache *pc = &page_cache[cpuid()];
+        if (pc->count == 0)
+            pc->count = fetch_free_pages(pc->pages, PAGE_CACHE_BATCH);
+        if (pc->count)
+            ret = pc->pages[--pc->count];
+    } else {
+        fetch_free_pages(&ret, 1);
+    }
+    return ret;
+}
+
+static void *_kalloc_page(bool may_reclaim)
+{
+    void *ret = take_free_page();
+    if (ret == NULL && may_reclaim) {
+        reclaim_memory();
+        ret = take_free_page();
+    }
+    if (ret == NULL)
+        return NULL;
+    increment_rc(&kalloc_page_cnt);
+    update_peak();
+    mem_events[cpuid()].page_allocs++;
     ASSERT(pages[PAGE_INDEX(ret)].ref.count == 0);
+    ASSERT(pages[PAGE_INDEX(ret)].mapcount == 0);
     increment_rc(&pages[PAGE_INDEX(ret)].ref);
     // printk("pages: %lld\n", left_page_cnt());
     return ret;
 }
 
+void *kalloc_page()
+{
+    return _kalloc_page(true);
+}
+
 void kfree_page(void *p)
 {
     if (p == zero_page)
         return;
     u64 idx = PAGE_INDEX(p);
     if (decrement_rc(&pages[idx].ref)) {
+        __atomic_store_n(&pages[idx].mapcount, 0, __ATOMIC_RELEASE);
         decrement_rc(&kalloc_page_cnt);
-        acquire_spinlock(&lock1);
-        free_pages->prev = (ListNode *)p;
-        free_pages->prev->next = free_pages;
-        free_pages = free_pages->prev;
-        release_spinlock(&lock1);
+        mem_events[cpuid()].page_frees++;
+        if (!page_cache_enabled) {
+            put_free_pages(&p, 1);
+            return;
+        }
+        struct page_cache *pc = &page_cache[cpuid()];
+        if (pc->count == PAGE_CACHE_SIZE) {
+            pc->count -= PAGE_CACHE_BATCH;
+            put_free_pages(pc->pages + pc->count, PAGE_CACHE_BATCH);
+        }
+        pc->pages[pc->count++] = p;
     }
     // printk("pages: %lld\n", left_page_cnt());
     return;
 }
 
-void *kalloc(u64 size)
+void *kalloc_pages(int order)
 {
-    acquire_spinlock(&lock2);
-    void *ret = fetch_slab(size);
-    release_spinlock(&lock2);
+    ASSERT(order >= 0 && order <= BUDDY_MAX_ORDER);
+    acquire_spinlock(&lock1);
+    void *ret = buddy_alloc(order);
+    release_spinlock(&lock1);
+    if (ret == NULL) {
+        reclaim_memory();
+        acquire_spinlock(&lock1);
+        ret = buddy_alloc(order);
+        release_spinlock(&lock1);
+    }
+    if (ret == NULL)
+        return NULL;
+    __atomic_fetch_add(&kalloc_page_cnt.count, 1ll << order, __ATOMIC_ACQ_REL);
+    update_peak();
+    mem_events[cpuid()].page_allocs += 1ull << order;
+    ASSERT(pages[PAGE_INDEX(ret)].ref.count == 0);
+    ASSERT(pages[PAGE_INDEX(ret)].mapcount == 0);
+    increment_rc(&pages[PAGE_INDEX(ret)].ref);
     return ret;
 }
 
-void kfree(void *ptr)
+void kfree_pages(void *p, int order)
 {
-    acquire_spinlock(&lock2);
-    u64 page = ((u64)ptr) & ~4095;
-    int *idx = (int *)page;
-    int index = *idx;
-    *(idx + 1) += 1; //free_block + 1
-    u64 slabsize = (index + 1) << 3;
-    if (*(idx + 1) == (int)((PAGE_SIZE - 8) / slabsize)) {
-        slab *cur = slabs[index];
-        u64 addr_cur = (u64)cur;
-        while (addr_cur >= page && addr_cur < page + PAGE_SIZE && cur != NULL) {
-            cur = cur->next;
-            addr_cur = (u64)cur;
+    u64 idx = PAGE_INDEX(p);
+    ASSERT((int)pages[idx].order == order);
+    if (decrement_rc(&pages[idx].ref)) {
+        __atomic_store_n(&pages[idx].mapcount, 0, __ATOMIC_RELEASE);
+        __atomic_fetch_sub(&kalloc_page_cnt.count, 1ll << order,
+                           __ATOMIC_ACQ_REL);
+        mem_events[cpuid()].page_frees += 1ull << order;
+        acquire_spinlock(&lock1);
+        buddy_free(idx, order);
+        release_spinlock(&lock1);
+    }
+}
+
+void *kalloc_zeroed_page()
+{
+    struct zero_pool *zp = &zero_pool[cpuid()];
+    if (zp->count)
+        return zp->pages[--zp->count];
+    void *ret = kalloc_page();
+    if (ret)
+        memset(ret, 0, PAGE_SIZE);
+    return ret;
+}
+
+bool refill_zero_pool()
+{
+    struct zero_pool *zp = &zero_pool[cpuid()];
+    // the pool must not be what pushes the allocator into reclaim
+    if (left_page_cnt() < ZERO_POOL_MIN_FREE)
+        return false;
+    for (int i = 0; i < ZERO_POOL_BATCH && zp->count < ZERO_POOL_SIZE; i++) {
+        // idle context: never reclaim or run shrinkers from here
+        void *p = _kalloc_page(false);
+        if (p == NULL)
+            break;
+        memset(p, 0, PAGE_SIZE);
+        zp->pages[zp->count++] = p;
+    }
+    return zp->count < ZERO_POOL_SIZE;
+}
+
+static INLINE u64 slab_index(u64 size)
+{
+    return size % 8 ? (size / 8) : ((size / 8) - 1);
+}
+
+static INLINE struct slab_page *slab_page_of(void *obj)
+{
+    return (struct slab_page *)PAGE_BASE(obj);
+}
+
+static INLINE slab *slab_link(struct kmem_cache *c, void *obj)
+{
+    return (slab *)((u64)obj + c->link);
+}
+
+static INLINE void *slab_obj(struct kmem_cache *c, slab *link)
+{
+    return (void *)((u64)link - c->link);
+}
+
+// the new page is private until linked into a list, so no lock is needed
+static struct slab_page *new_slab(struct kmem_cache *c)
+{
+    struct slab_page *sp = kalloc_page();
+    if (sp == NULL)
+        return NULL;
+    sp->cache = c;
+    sp->inuse = 0;
+    sp->total = (PAGE_SIZE - c->offset) / c->stride;
+    ASSERT(sp->total > 0);
+    sp->freelist = NULL;
+    for (int i = sp->total - 1; i >= 0; i--) {
+        void *obj = (void *)((u64)sp + c->offset + i * c->stride);
+        if (c->ctor)
+            c->ctor(obj);
+        slab *s = slab_link(c, obj);
+        s->next = sp->freelist;
+        sp->freelist = s;
+    }
+    return sp;
+}
+
+// call with c->lock. returns NULL when out of memory
+static void *fetch_slab(struct kmem_cache *c)
+{
+    struct slab_page *sp;
+    if (!_empty_list(&c->partial)) {
+        sp = container_of(c->partial.next, struct slab_page, node);
+    } else if (!_empty_list(&c->empty)) {
+        sp = container_of(c->empty.next, struct slab_page, node);
+        _detach_from_list(&sp->node);
+        c->nr_empty--;
+        _insert_into_list(&c->partial, &sp->node);
+    } else {
+        // kalloc_page may reclaim, and reclaim frees objects into caches
+        release_spinlock(&c->lock);
+        sp = new_slab(c);
+        acquire_spinlock(&c->lock);
+        if (sp == NULL)
+            return NULL;
+        _insert_into_list(&c->partial, &sp->node);
+    }
+    slab *ret = sp->freelist;
+    sp->freelist = ret->next;
+    if (++sp->inuse == sp->total) {
+        _detach_from_list(&sp->node);
+        _insert_into_list(&c->full, &sp->node);
+    }
+    return slab_obj(c, ret);
+}
+
+// return an object to its slab page, releasing the page if the cache
+// already holds enough empty ones. call with c->lock
+static void release_slab(struct kmem_cache *c, void *ptr)
+{
+    struct slab_page *sp = slab_page_of(ptr);
+    slab *s = slab_link(c, ptr);
+    s->next = sp->freelist;
+    sp->freelist = s;
+    if (sp->inuse-- == sp->total) {
+        _detach_from_list(&sp->node);
+        _insert_into_list(&c->partial, &sp->node);
+    }
+    if (sp->inuse == 0) {
+        _detach_from_list(&sp->node);
+        if (c->nr_empty < SLAB_MAX_EMPTY) {
+            _insert_into_list(&c->empty, &sp->node);
+            c->nr_empty++;
+        } else {
+            kfree_page(sp);
         }
-        slabs[index] = cur;
-
-        while (cur != NULL) {
-            u64 addr_next = (u64)(cur->next);
-            if (addr_next >= page && addr_next < page + PAGE_SIZE &&
-                cur->next != NULL) {
-                cur->next = cur->next->next;
-            } else if (cur->next == NULL) {
-                break;
-            } else {
-                cur = cur->next;
+    }
+}
+
+static void kmem_cache_init(struct kmem_cache *c, const char *name, u64 size,
+                            u64 align, void (*ctor)(void *))
+{
+    align = MAX(align, 8ull);
+    ASSERT((align & (align - 1)) == 0);
+    c->name = name;
+    c->size = size;
+    c->ctor = ctor;
+    // a constructed object must survive sitting on the freelist, so caches
+    // with a constructor keep the link in a word past the object
+    c->link = ctor ? round_up(size, 8) : 0;
+    c->stride = round_up(MAX(c->link + sizeof(slab), size), align);
+    c->offset = round_up(sizeof(struct slab_page), align);
+    init_spinlock(&c->lock);
+    init_list_node(&c->partial);
+    init_list_node(&c->full);
+    init_list_node(&c->empty);
+    c->nr_empty = 0;
+    for (int i = 0; i != NCPU; i++)
+        c->magazine[i].count = 0;
+    acquire_spinlock(&lock2);
+    _insert_into_list(&cache_list, &c->cache_node);
+    release_spinlock(&lock2);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, u64 size, u64 align,
+                                     void (*ctor)(void *))
+{
+    struct kmem_cache *c = kalloc(sizeof(struct kmem_cache));
+    if (c == NULL)
+        return NULL;
+    kmem_cache_init(c, name, size, align, ctor);
+    return c;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *c)
+{
+    void *ret;
+    if (!slab_magazine_enabled) {
+        acquire_spinlock(&c->lock);
+        ret = fetch_slab(c);
+        release_spinlock(&c->lock);
+    } else {
+        struct slab_magazine *mag = &c->magazine[cpuid()];
+        if (mag->count == 0) {
+            acquire_spinlock(&c->lock);
+            while (mag->count < SLAB_MAGAZINE_BATCH) {
+                void *obj = fetch_slab(c);
+                if (obj == NULL)
+                    break;
+                mag->objs[mag->count++] = obj;
             }
+            release_spinlock(&c->lock);
         }
-        kfree_page((void *)page);
-    } else {
-        free_slab((slab *)ptr, index);
+        ret = mag->count ? mag->objs[--mag->count] : NULL;
     }
-    release_spinlock(&lock2);
-    return;
+    if (ret)
+        mem_events[cpuid()].obj_allocs++;
+    return ret;
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *ptr)
+{
+    ASSERT(slab_page_of(ptr)->cache == c);
+    mem_events[cpuid()].obj_frees++;
+    if (!slab_magazine_enabled) {
+        acquire_spinlock(&c->lock);
+        release_slab(c, ptr);
+        release_spinlock(&c->lock);
+        return;
+    }
+    struct slab_magazine *mag = &c->magazine[cpuid()];
+    if (mag->count == SLAB_MAGAZINE_SIZE) {
+        acquire_spinlock(&c->lock);
+        while (mag->count > SLAB_MAGAZINE_SIZE - SLAB_MAGAZINE_BATCH)
+            release_slab(c, mag->objs[--mag->count]);
+        release_spinlock(&c->lock);
+    }
+    mag->objs[mag->count++] = ptr;
+}
+
+/**
+ * objects above KMALLOC_MAX_SLAB would waste most of a slab page, so they
+ * get a run of 2^order pages instead. the head page is tagged PG_LARGE and
+ * keeps the order in `pages[]`; slab objects never start on a page boundary
+ * because of the slab header, which lets kfree tell the two apart.
+ */
+static void *kalloc_large(u64 size)
+{
+    int order = 0;
+    while (((u64)PAGE_SIZE << order) < size)
+        order++;
+    ASSERT(order <= BUDDY_MAX_ORDER);
+    void *ret = kalloc_pages(order);
+    if (ret)
+        set_page_flag(&pages[PAGE_INDEX(ret)], PG_LARGE);
+    return ret;
+}
+
+void *kalloc(u64 size)
+{
+    if (size > KMALLOC_MAX_SLAB)
+        return kalloc_large(size);
+    return kmem_cache_alloc(&kmalloc_caches[slab_index(size)]);
+}
+
+void kfree(void *ptr)
+{
+    if (PAGE_BASE((u64)ptr) == (u64)ptr) {
+        struct page *pg = &pages[PAGE_INDEX(ptr)];
+        ASSERT(test_page_flag(pg, PG_LARGE));
+        clear_page_flag(pg, PG_LARGE);
+        kfree_pages(ptr, pg->order);
+        return;
+    }
+    kmem_cache_free(slab_page_of(ptr)->cache, ptr);
 }
 
 void *get_zero_page()
@@ -189,6 +663,68 @@ void *get_zero_page()
     return zero_page;
 }
 
+static void get_cache_stat(struct kmem_cache *c, struct memstat_cache *st)
+{
+    strncpy(st->name, c->name, MEMSTAT_NAME_LEN - 1);
+    st->name[MEMSTAT_NAME_LEN - 1] = 0;
+    st->obj_size = c->size;
+    st->pages = st->objs_inuse = st->objs_free = 0;
+    ListNode *lists[] = {&c->partial, &c->full, &c->empty};
+    for (int i = 0; i != 3; i++) {
+        _for_in_list(p, lists[i])
+        {
+            if (p == lists[i])
+                continue;
+            struct slab_page *sp = container_of(p, struct slab_page, node);
+            st->pages++;
+            st->objs_inuse += sp->inuse;
+            st->objs_free += sp->total - sp->inuse;
+        }
+    }
+    // objects parked in magazines look allocated to the slab pages
+    for (int i = 0; i != NCPU; i++) {
+        st->objs_inuse -= c->magazine[i].count;
+        st->objs_free += c->magazine[i].count;
+    }
+}
+
+void get_memstat(struct memstat *st)
+{
+    memset(st, 0, sizeof(struct memstat));
+    st->uptime_ms = get_timestamp_ms();
+    st->total_pages = ALLOCATABLE_PAGE_COUNT;
+    st->used_pages = kalloc_page_cnt.count;
+    st->peak_used_pages = peak_page_cnt;
+    for (int i = 0; i != NCPU; i++) {
+        st->page_cache[i] = page_cache[i].count;
+        st->zero_pool[i] = zero_pool[i].count;
+        st->page_allocs += mem_events[i].page_allocs;
+        st->page_frees += mem_events[i].page_frees;
+        st->obj_allocs += mem_events[i].obj_allocs;
+        st->obj_frees += mem_events[i].obj_frees;
+    }
+    acquire_spinlock(&lock1);
+    for (int i = 0; i <= BUDDY_MAX_ORDER; i++)
+        st->buddy_free[i] = free_area[i].nr_free;
+    release_spinlock(&lock1);
+    acquire_spinlock(&lock2);
+    _for_in_list(p, &cache_list)
+    {
+        if (p == &cache_list)
+            continue;
+        struct kmem_cache *c = container_of(p, struct kmem_cache, cache_node);
+        if (st->nr_caches == MEMSTAT_MAX_CACHES)
+            break;
+        struct memstat_cache *cs = &st->caches[st->nr_caches];
+        acquire_spinlock(&c->lock);
+        get_cache_stat(c, cs);
+        release_spinlock(&c->lock);
+        if (cs->pages)
+            st->nr_caches++;
+    }
+    release_spinlock(&lock2);
+}
+
 u64 left_page_cnt()
 {
     return ALLOCATABLE_PAGE_COUNT - kalloc_page_cnt.count;
@@ -204,8 +740,24 @@ void kshare_page(u64 addr)
 u64 get_page_ref(u64 addr)
 {
     auto index = PAGE_INDEX(PAGE_BASE(addr));
-    acquire_spinlock(&lock1);
-    auto ret = pages[index].ref.count;
-    release_spinlock(&lock1);
-    return ret;
+    return __atomic_load_n(&pages[index].ref.count, __ATOMIC_ACQUIRE);
+}
+
+void page_map(u64 addr)
+{
+    u64 index = PAGE_INDEX(PAGE_BASE(addr));
+    __atomic_fetch_add(&pages[index].mapcount, 1, __ATOMIC_ACQ_REL);
+}
+
+void page_unmap(u64 addr)
+{
+    u64 index = PAGE_INDEX(PAGE_BASE(addr));
+    __atomic_fetch_sub(&pages[index].mapcount, 1, __ATOMIC_ACQ_REL);
+    kfree_page((void *)PAGE_BASE(addr));
+}
+
+u64 get_page_mapcount(u64 addr)
+{
+    u64 index = PAGE_INDEX(PAGE_BASE(addr));
+    return __atomic_load_n(&pages[index].mapcount, __ATOMIC_ACQUIRE);
 }
\ No newline at end of file
@@ -10,19 +10,94 @@
 #define ALL_PAGE_COUNT ((PHYSTOP - EXTMEM) / PAGE_SIZE)
 #define PAGE_INDEX(page) ((KSPACE((u64)page) - P2K(EXTMEM)) / PAGE_SIZE)
 
+// pages[] describes every physical page from EXTMEM to PHYSTOP
+#define BUDDY_MAX_ORDER 10 // largest contiguous run: 2^10 pages (4 MiB)
+
+#define PG_BUDDY BIT(0) // head of a free block in the buddy allocator
+#define PG_LARGE BIT(1) // head of a page run handed out by kalloc
+
+/**
+ * ref, flags and mapcount are only touched with atomics, so page state can
+ * be queried and updated without lock1. lock1 only serializes the buddy
+ * free lists.
+ */
 struct page {
     RefCount ref;
+    u16 flags;
+    u16 order; // order of the free block or allocation this page heads
+    u32 mapcount; // user page table entries pointing at this page
 };
 
+static INLINE void set_page_flag(struct page *pg, u16 flag)
+{
+    __atomic_fetch_or(&pg->flags, flag, __ATOMIC_RELEASE);
+}
+
+static INLINE void clear_page_flag(struct page *pg, u16 flag)
+{
+    __atomic_fetch_and(&pg->flags, (u16)~flag, __ATOMIC_RELEASE);
+}
+
+static INLINE bool test_page_flag(struct page *pg, u16 flag)
+{
+    return (__atomic_load_n(&pg->flags, __ATOMIC_ACQUIRE) & flag) != 0;
+}
+
 void kinit();
 u64 left_page_cnt();
 
+// all allocators return NULL once the shrinkers cannot free any more memory
 WARN_RESULT void *kalloc_page();
 void kfree_page(void *);
 
+// a zero-filled page, taken from the per-CPU pre-zeroed pool when possible
+WARN_RESULT void *kalloc_zeroed_page();
+// zero a few more pages into this CPU's pool; true if it is not full yet.
+// called from the idle loop
+bool refill_zero_pool();
+
+// allocate 2^order physically contiguous pages, aligned to their size
+WARN_RESULT void *kalloc_pages(int order);
+void kfree_pages(void *, int order);
+
 WARN_RESULT void *kalloc(unsigned long long);
 void kfree(void *);
 
+#define CACHELINE_SIZE 64
+
+/**
+ * typed object caches: slab pages dedicated to one object type. ctor, if
+ * given, runs once when an object first enters the cache; objects must be
+ * handed back to kmem_cache_free in their constructed state.
+ */
+struct kmem_cache;
+// NULL if the cache descriptor cannot be allocated
+WARN_RESULT struct kmem_cache *kmem_cache_create(const char *name, u64 size, u64 align,
+                                     void (*ctor)(void *));
+WARN_RESULT void *kmem_cache_alloc(struct kmem_cache *);
+void kmem_cache_free(struct kmem_cache *, void *);
+
+/**
+ * a cache outside the allocator that can give memory back. shrink(nr) should
+ * drop up to nr unused objects and return how many it dropped. it runs in
+ * the allocation path, so it must not allocate and must only try its locks.
+ */
+struct shrinker {
+    ListNode node;
+    u64 (*shrink)(u64 nr);
+};
+void register_shrinker(struct shrinker *);
+
+struct memstat;
+// fill a snapshot of the allocator state, see kernel/memstat.h
+void get_memstat(struct memstat *);
+
 WARN_RESULT void *get_zero_page();
 void kshare_page(u64);
-u64 get_page_ref(u64 addr);
\ No newline at end of file
+u64 get_page_ref(u64 addr);
+
+// vmmap counts a new user mapping of a page; page_unmap drops the mapping
+// together with the reference it held
+void page_map(u64 addr);
+void page_unmap(u64 addr);
+u64 get_page_mapcount(u64 addr);
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <common/defines.h>
+
+/**
+ * the snapshot returned by the memstat syscall. it is shared with user
+ * programs, so it only uses fixed-size fields.
+ */
+
+#define MEMSTAT_NCPU 4 // == NCPU
+#define MEMSTAT_NORDER 11 // == BUDDY_MAX_ORDER + 1
+#define MEMSTAT_MAX_CACHES 64
+#define MEMSTAT_NAME_LEN 16
+
+struct memstat_cache {
+    char name[MEMSTAT_NAME_LEN];
+    u64 obj_size;
+    u64 objs_inuse; // handed out to callers
+    u64 objs_free; // free in slab pages or sitting in per-CPU magazines
+    u64 pages; // slab pages currently owned by the cache
+};
+
+struct memstat {
+    u64 uptime_ms;
+
+    // page allocator, in pages
+    u64 total_pages;
+    u64 used_pages;
+    u64 peak_used_pages;
+    u64 page_cache[MEMSTAT_NCPU]; // free pages in each per-CPU page cache
+    u64 zero_pool[MEMSTAT_NCPU]; // pre-zeroed pages held by each CPU
+    u64 buddy_free[MEMSTAT_NORDER]; // free blocks of each order
+
+    // event counters since boot
+    u64 page_allocs;
+    u64 page_frees;
+    u64 obj_allocs;
+    u64 obj_frees;
+
+    // caches holding at least one slab page
+    u64 nr_caches;
+    struct memstat_cache caches[MEMSTAT_MAX_CACHES];
+};
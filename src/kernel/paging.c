@@ -11,6 +11,7 @@
 #include <kernel/proc.h>
 #include <kernel/pt.h>
 #include <kernel/sched.h>
+#include <kernel/syscall.h>
 #include <sys/mman.h>
 
 #define ISS_TYPE_MASK 0x3c
@@ -18,6 +19,15 @@
 #define ISS_ACC_FAULT 0X8
 #define ISS_PERMI_FAULT 0Xc
 
+struct kmem_cache *section_cache;
+
+define_early_init(section_cache)
+{
+    section_cache =
+            kmem_cache_create("section", sizeof(struct section), 8, NULL);
+    ASSERT(section_cache);
+}
+
 void init_section(struct section *sec)
 {
     memset(sec, 0, sizeof(struct section));
@@ -48,7 +58,8 @@ void free_pages_of_section(struct pgdir *pd, struct section *sec)
         if (pte && (*pte & PTE_VALID)) {
             if ((sec->flags == ST_MMAP_PRIVATE ||
                  sec->flags == ST_MMAP_SHARED) &&
-                !(*pte & PTE_RO) && get_page_ref(P2K(PTE_ADDRESS(*pte))) == 1) {
+                !(*pte & PTE_RO) &&
+                get_page_mapcount(P2K(PTE_ADDRESS(*pte))) == 1) {
                 // printk("write back\n");
                 if (sec->fp->type == FD_INODE) {
                     u64 this_begin = MAX(i, sec->begin);
@@ -62,7 +73,7 @@ void free_pages_of_section(struct pgdir *pd, struct section *sec)
                 } else
                     PANIC();
             }
-            kfree_page((void *)P2K(PTE_ADDRESS(*pte)));
+            page_unmap(P2K(PTE_ADDRESS(*pte)));
             *pte = NULL;
         }
     }
@@ -71,6 +82,7 @@ void free_pages_of_section(struct pgdir *pd, struct section *sec)
 void free_sections(struct pgdir *pd)
 {
     /* (Final) TODO BEGIN */
+    write_seqlock(&pd->section_lock);
     acquire_spinlock(&pd->lock);
     ListNode *p = pd->section_head.next;
     while (p != &(pd->section_head)) {
@@ -80,9 +92,10 @@ void free_sections(struct pgdir *pd)
         _detach_from_list(&sec->stnode);
         if (sec->fp)
             file_close(sec->fp);
-        kfree(sec);
+        kmem_cache_free(section_cache, sec);
     }
     release_spinlock(&pd->lock);
+    write_sequnlock(&pd->section_lock);
 
     /* (Final) TODO END */
 }
@@ -118,13 +131,13 @@ u64 sbrk(i64 size)
     struct pgdir *pd = &p->pgdir;
     struct section *sec;
 
-    acquire_spinlock(&pd->lock);
-
     // get heap section of current process
     ASSERT((sec = find_type_section(pd, ST_HEAP)));
 
     if (size == 0)
         return sec->end;
+    write_seqlock(&pd->section_lock);
+    acquire_spinlock(&pd->lock);
     u64 ret = sec->end;
     sec->end += size;
     if (size > 0) {
@@ -137,16 +150,62 @@ u64 sbrk(i64 size)
         for (u64 i = sec->end; i < ret; i += PAGE_SIZE) {
             PTEntriesPtr pte = get_pte(pd, i, false);
             if (pte && *pte & PTE_VALID) {
-                kfree_page((void *)P2K(PTE_ADDRESS(*pte)));
+                page_unmap(P2K(PTE_ADDRESS(*pte)));
                 *pte = 0;
             }
         }
     }
     release_spinlock(&pd->lock);
+    write_sequnlock(&pd->section_lock);
     return ret;
     /* (Final) TODO END */
 }
 
+// memory is exhausted: kill the faulting process. call with pd->lock
+static NO_RETURN void fault_oom(struct pgdir *pd)
+{
+    release_spinlock(&pd->lock);
+    printk("pgfault: out of memory, killing %d\n", thisproc()->pid);
+    exit(-1);
+}
+
+// a page for the faulting process. call with pd->lock
+static void *fault_page(struct pgdir *pd, bool zero)
+{
+    void *pg = zero ? kalloc_zeroed_page() : kalloc_page();
+    if (pg == NULL)
+        fault_oom(pd);
+    return pg;
+}
+
+// map pg for the faulting process. call with pd->lock
+static void fault_map(struct pgdir *pd, u64 va, void *pg, u64 flags)
+{
+    if (vmmap(pd, va, pg, flags) < 0) {
+        kfree_page(pg);
+        fault_oom(pd);
+    }
+}
+
+// give the faulting process a private, writable copy of a shared page.
+// call with pd->lock
+static void cow_page(struct pgdir *pd, u64 addr)
+{
+    auto pte = get_pte(pd, addr, false);
+    ASSERT(pte);
+    u64 old = P2K(PTE_ADDRESS(*pte));
+    // every other sharer has unmapped it: take the page over, no copy
+    if ((void *)old != get_zero_page() && get_page_mapcount(old) == 1) {
+        *pte &= ~(u64)PTE_RO;
+        arch_tlbi_vmalle1is();
+        return;
+    }
+    void *pg = fault_page(pd, false);
+    memcpy(pg, (void *)old, PAGE_SIZE); // copy the previous page
+    page_unmap(old); // unshare the previously shared page
+    fault_map(pd, addr, pg, PTE_USER_DATA | PTE_RW);
+}
+
 int pgfault_handler(u64 iss)
 {
     Proc *p = thisproc();
@@ -163,20 +222,25 @@ int pgfault_handler(u64 iss)
      * 4. Return to user code or kill the process.
      */
     // printk("(page fault) addr: %llx\n", addr);
-    struct section *sec = NULL;
-    acquire_spinlock(&pd->lock);
-    _for_in_list(p, &pd->section_head)
-    {
-        if (p == &pd->section_head) {
-            continue;
+    struct section *sec;
+    u32 seq;
+    do {
+        seq = read_seqbegin(&pd->section_lock);
+        sec = NULL;
+        _for_in_list(p, &pd->section_head)
+        {
+            if (p == &pd->section_head) {
+                continue;
+            }
+            sec = container_of(p, struct section, stnode);
+            if (sec->begin <= addr && addr < sec->end)
+                break;
+            else
+                sec = NULL;
         }
-        sec = container_of(p, struct section, stnode);
-        if (sec->begin <= addr && addr < sec->end)
-            break;
-        else
-            sec = NULL;
-    }
+    } while (read_seqretry(&pd->section_lock, seq));
     ASSERT(sec);
+    acquire_spinlock(&pd->lock);
     /**
      * @todo mmap
     */
@@ -184,21 +248,14 @@ int pgfault_handler(u64 iss)
     switch (sec->flags) {
     case ST_HEAP:
         // printk("heap\n");
-        pg = kalloc_page();
-        vmmap(pd, addr, p, PTE_USER_DATA | PTE_RW);
+        pg = fault_page(pd, true);
+        fault_map(pd, addr, pg, PTE_USER_DATA | PTE_RW);
         // printk("vmmap\n");
         break;
     case ST_DATA:
         // printk("bss\n");
         if ((ISS_TYPE_MASK & iss) == ISS_PERMI_FAULT) {
-            pg = kalloc_page();
-            auto pte = get_pte(pd, addr, false);
-            ASSERT(pte);
-            memcpy(pg, (void *)P2K(PTE_ADDRESS(*pte)),
-                   PAGE_SIZE); // copy the previous page
-            kfree_page((void *)P2K(
-                    PTE_ADDRESS(*pte))); // unshare the previously shared page
-            vmmap(pd, addr, pg, PTE_USER_DATA | PTE_RW);
+            cow_page(pd, addr);
         } else {
             PANIC();
         }
@@ -214,9 +271,11 @@ int pgfault_handler(u64 iss)
         while (len) {
             usize cur_len = MIN(len, (u64)PAGE_SIZE - VA_OFFSET(va));
             auto pte = get_pte(pd, va, true);
+            if (pte == NULL)
+                fault_oom(pd);
             if (!(*pte & PTE_VALID)) {
-                pg = kalloc_page();
-                vmmap(pd, va, pg, PTE_USER_DATA | PTE_RO);
+                pg = fault_page(pd, true);
+                fault_map(pd, va, pg, PTE_USER_DATA | PTE_RO);
             }
             if (file_read(sec->fp,
                           (char *)(P2K(PTE_ADDRESS(*pte)) + VA_OFFSET(va)),
@@ -232,18 +291,12 @@ int pgfault_handler(u64 iss)
         break;
     case ST_USER_STACK:
         if ((ISS_TYPE_MASK & iss) == ISS_PERMI_FAULT) {
-            pg = kalloc_page();
-            auto pte = get_pte(pd, addr, false);
-            ASSERT(pte);
-            memcpy(pg, (void *)P2K(PTE_ADDRESS(*pte)), PAGE_SIZE);
-            kfree_page((void *)P2K(
-                    PTE_ADDRESS(*pte))); // unshare the previously shared page
-            vmmap(pd, addr, pg, PTE_USER_DATA | PTE_RW);
+            cow_page(pd, addr);
         } else {
             // copy on write
             // printk("user stack COW\n");
-            pg = kalloc_page();
-            vmmap(pd, addr, p, PTE_USER_DATA | PTE_RW);
+            pg = fault_page(pd, true);
+            fault_map(pd, addr, pg, PTE_USER_DATA | PTE_RW);
         }
         break;
         /**
@@ -259,21 +312,37 @@ int pgfault_handler(u64 iss)
     /* (Final) TODO END */
 }
 
-void copy_sections(ListNode *from_head, ListNode *to_head)
+int copy_sections(ListNode *from_head, ListNode *to_head)
 {
     /* (Final) TODO BEGIN */
+    int n = 0;
     _for_in_list(node, from_head)
     {
         if (node == from_head) {
             break;
         }
         struct section *st = container_of(node, struct section, stnode);
-        struct section *new_st = kalloc(sizeof(struct section));
+        struct section *new_st = kmem_cache_alloc(section_cache);
+        if (new_st == NULL)
+            goto nomem;
         memmove(new_st, st, sizeof(struct section));
         if (st->fp != NULL) {
             new_st->fp = file_dup(st->fp);
         }
         _insert_into_list(to_head, &(new_st->stnode));
+        n++;
+    }
+    return 0;
+
+nomem:
+    // the copies went in right after to_head
+    while (n--) {
+        struct section *sec = container_of(to_head->next, struct section, stnode);
+        _detach_from_list(&sec->stnode);
+        if (sec->fp)
+            file_close(sec->fp);
+        kmem_cache_free(section_cache, sec);
     }
+    return -1;
     /* (Final) TODO END */
 }
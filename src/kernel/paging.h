@@ -34,5 +34,7 @@ int pgfault_handler(u64 iss);
 void init_sections(ListNode *section_head);
 void free_pages_of_section(struct pgdir *pd, struct section *sec);
 void free_sections(struct pgdir *pd);
-void copy_sections(ListNode *from_head, ListNode *to_head);
+WARN_RESULT int copy_sections(ListNode *from_head, ListNode *to_head);
 u64 sbrk(i64 size);
+
+extern struct kmem_cache *section_cache;
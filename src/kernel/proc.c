@@ -5,9 +5,11 @@
 #include <common/list.h>
 #include <common/string.h>
 #include <common/pid.h>
+#include <common/rwlock.h>
 #include <kernel/printk.h>
 #include <kernel/paging.h>
 #include <fs/inode.h>
+#include <kernel/syscall.h>
 
 Proc root_proc;
 BITMAP pid_map;
@@ -15,7 +17,16 @@ BITMAP pid_map;
 void kernel_entry();
 void proc_entry();
 
-static SpinLock plock;
+// the pid tree: kill and the pid lookups only read it
+static RWLock plock;
+
+struct kmem_cache *proc_cache;
+
+define_early_init(proc_cache)
+{
+    proc_cache = kmem_cache_create("proc", sizeof(Proc), CACHELINE_SIZE, NULL);
+    ASSERT(proc_cache);
+}
 
 // init_kproc initializes the kernel process
 // NOTE: should call after kinit
@@ -24,21 +35,25 @@ void init_kproc()
     // TODO:
     // 1. init global resources (e.g. locks, semaphores)
     // 2. init the root_proc (finished)
-    init_spinlock(&plock);
+    init_rwlock(&plock);
     init_bitmap(&pid_map);
 
-    init_proc(&root_proc);
+    bool ok = init_proc(&root_proc) == 0;
+    ASSERT(ok);
     root_proc.parent = &root_proc;
     start_proc(&root_proc, kernel_entry, 123456);
 }
 
-void init_proc(Proc *p)
+int init_proc(Proc *p)
 {
     // TODO:
     // setup the Proc with kstack and pid allocated
     // NOTE: be careful of concurrency
 
-    acquire_spinlock(&plock);
+    void *kstack = kalloc_page();
+    if (kstack == NULL)
+        return -1;
+    acquire_write_lock(&plock);
 
     memset(p, 0, sizeof(Proc));
     p->pid = alloc_pid(&pid_map);
@@ -47,7 +62,7 @@ void init_proc(Proc *p)
     init_list_node(&p->children);
     ASSERT(_empty_list(&p->children));
     init_list_node(&p->ptnode);
-    p->kstack = kalloc_page();
+    p->kstack = kstack;
     memset((void *)p->kstack, 0, PAGE_SIZE);
     init_schinfo(&p->schinfo);
     init_pgdir(&p->pgdir);
@@ -59,25 +74,45 @@ void init_proc(Proc *p)
     if (inodes.root)
         p->cwd = inodes.share(inodes.root);
     init_oftable(&p->oftable);
-    release_spinlock(&plock);
+    release_write_lock(&plock);
+    return 0;
 }
 
 Proc *create_proc()
 {
-    Proc *p = kalloc(sizeof(Proc));
-    init_proc(p);
+    Proc *p = kmem_cache_alloc(proc_cache);
+    if (p == NULL)
+        return NULL;
+    if (init_proc(p) < 0) {
+        kmem_cache_free(proc_cache, p);
+        return NULL;
+    }
     return p;
 }
 
+// undo create_proc() for a proc never started nor linked into the tree
+static void destroy_proc(Proc *p)
+{
+    free_sections(&p->pgdir);
+    free_pgdir(&p->pgdir);
+    if (p->cwd)
+        decrement_rc(&p->cwd->rc);
+    kfree_page(p->kstack);
+    acquire_write_lock(&plock);
+    free_pid(&pid_map, p->pid);
+    release_write_lock(&plock);
+    kmem_cache_free(proc_cache, p);
+}
+
 void set_parent_to_this(Proc *proc)
 {
     // TODO: set the parent of proc to thisproc
     // NOTE: maybe you need to lock the process tree
     // NOTE: it's ensured that the old proc->parent = NULL
-    acquire_spinlock(&plock);
+    acquire_write_lock(&plock);
     proc->parent = thisproc();
     _insert_into_list(&thisproc()->children, &proc->ptnode);
-    release_spinlock(&plock);
+    release_write_lock(&plock);
 }
 
 int start_proc(Proc *p, void (*entry)(u64), u64 arg)
@@ -88,10 +123,10 @@ int start_proc(Proc *p, void (*entry)(u64), u64 arg)
     // 3. activate the proc and return its pid
     // NOTE: be careful of concurrency
     if (p->parent == NULL) {
-        acquire_spinlock(&plock);
+        acquire_write_lock(&plock);
         p->parent = &root_proc;
         _insert_into_list(&root_proc.children, &p->ptnode);
-        release_spinlock(&plock);
+        release_write_lock(&plock);
     }
     p->kcontext->lr = (u64)&proc_entry;
     p->kcontext->x0 = (u64)entry;
@@ -117,7 +152,7 @@ int wait(int *exitcode)
 
     bool res = wait_sem(&this->childexit);
     if (res) {
-        acquire_spinlock(&plock);
+        acquire_write_lock(&plock);
         _for_in_list(p, &this->children)
         {
             if (p == &this->children)
@@ -128,12 +163,12 @@ int wait(int *exitcode)
                 id = child->pid;
                 _detach_from_list(p);
                 kfree_page(child->kstack);
-                kfree(child);
+                kmem_cache_free(proc_cache, child);
                 free_pid(&pid_map, id); // free pid here
                 break;
             }
         }
-        release_spinlock(&plock);
+        release_write_lock(&plock);
         return id;
     } else {
         PANIC();
@@ -149,7 +184,7 @@ NO_RETURN void exit(int code)
     // 4. sched(ZOMBIE)
     // NOTE: be careful of concurrency
 
-    acquire_spinlock(&plock);
+    acquire_write_lock(&plock);
 
     auto this = thisproc();
     this->exitcode = code;
@@ -168,7 +203,7 @@ NO_RETURN void exit(int code)
     post_sem(&this->parent->childexit);
 
     acquire_sched_lock();
-    release_spinlock(&plock);
+    release_write_lock(&plock);
     free_pgdir(&this->pgdir);
     // Final
     decrement_rc(&this->cwd->rc);
@@ -197,20 +232,55 @@ Proc *dfs(Proc *p, int pid)
     return NULL;
 }
 
+static void walk(Proc *p, void (*fn)(Proc *, void *), void *arg)
+{
+    fn(p, arg);
+    _for_in_list(child, &p->children)
+    {
+        if (child == &p->children)
+            continue;
+        walk(container_of(child, Proc, ptnode), fn, arg);
+    }
+}
+
+void walk_procs(void (*fn)(Proc *, void *), void *arg)
+{
+    acquire_read_lock(&plock);
+    walk(&root_proc, fn, arg);
+    release_read_lock(&plock);
+}
+
+Proc *get_proc(int pid)
+{
+    acquire_read_lock(&plock);
+    Proc *p = pid ? dfs(&root_proc, pid) : thisproc();
+    if (p == NULL || is_unused(p)) {
+        release_read_lock(&plock);
+        return NULL;
+    }
+    return p;
+}
+
+void put_proc(Proc *p)
+{
+    (void)p;
+    release_read_lock(&plock);
+}
+
 int kill(int pid)
 {
     // TODO:
     // Set the killed flag of the proc to true and return 0.
     // Return -1 if the pid is invalid (proc not found).
-    acquire_spinlock(&plock);
+    acquire_read_lock(&plock);
     Proc *p = dfs(&root_proc, pid);
     if (p && !is_unused(p)) {
         p->killed = TRUE;
         alert_proc(p);
-        release_spinlock(&plock);
+        release_read_lock(&plock);
         return 0;
     }
-    release_spinlock(&plock);
+    release_read_lock(&plock);
     return -1;
 }
 
@@ -233,10 +303,13 @@ int fork()
      */
     // 1. 4.
     Proc *parent = thisproc(), *child = create_proc();
-    acquire_spinlock(&plock);
-    child->parent = parent;
-    _insert_into_list(&parent->children, &child->ptnode);
-    release_spinlock(&plock);
+    if (child == NULL)
+        return -1;
+    set_proc_nice(child, get_proc_nice(parent));
+    int rt_priority, policy = get_proc_policy(parent, &rt_priority);
+    bool inherited = set_proc_policy(child, policy, rt_priority) &&
+                     set_proc_affinity(child, get_proc_affinity(parent));
+    ASSERT(inherited);
 
     // 2.
     memcpy((void *)child->ucontext, (void *)parent->ucontext,
@@ -250,8 +323,9 @@ int fork()
         if (p == head)
             continue;
         struct section *sec = container_of(p, struct section, stnode);
-        struct section *new_sec =
-                (struct section *)kalloc(sizeof(struct section));
+        struct section *new_sec = kmem_cache_alloc(section_cache);
+        if (new_sec == NULL)
+            goto nomem;
         init_section(new_sec);
         new_sec->begin = sec->begin;
         new_sec->end = sec->end;
@@ -266,14 +340,21 @@ int fork()
             auto pte = get_pte(&parent->pgdir, va, false);
             if (pte && (*pte & PTE_VALID)) {
                 *pte |= PTE_RO; // freeze shared page
-                vmmap(&child->pgdir, va, (void *)P2K(PTE_ADDRESS(*pte)),
-                      PTE_FLAGS(*pte));
+                if (vmmap(&child->pgdir, va, (void *)P2K(PTE_ADDRESS(*pte)),
+                          PTE_FLAGS(*pte)) < 0)
+                    goto nomem;
                 kshare_page(P2K(PTE_ADDRESS(*pte)));
             }
         }
     }
     release_spinlock(&parent->pgdir.lock);
 
+    // the copy can no longer fail: make the child visible
+    acquire_write_lock(&plock);
+    child->parent = parent;
+    _insert_into_list(&parent->children, &child->ptnode);
+    release_write_lock(&plock);
+
     memset((void *)&child->oftable, 0, sizeof(struct oftable));
     if (child->cwd != parent->cwd) {
         OpContext ctx;
@@ -293,5 +374,10 @@ int fork()
     start_proc(child, trap_return, 0);
     child->ucontext->gregs[0] = 0;
     return child->pid;
+
+nomem:
+    release_spinlock(&parent->pgdir.lock);
+    destroy_proc(child);
+    return -1;
     /* (Final) TODO END */
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <common/sem.h>
 #include <common/rbtree.h>
 #include <kernel/pt.h>
+#include <kernel/schedstat.h>
 #include <fs/file.h>
 #include <fs/inode.h>
 
@@ -28,7 +29,26 @@ typedef struct KernelContext {
 struct schinfo {
     // TODO: customize your sched info
     struct rb_node_ rq;
-    u64 runtime;
+    u64 runtime; // CPU time consumed, in timer counter ticks
+    u64 vruntime; // runtime scaled by the weight of `nice`, orders rq
+    u64 exec_start; // timestamp when the proc last went on the CPU
+    int nice;
+    int cpu; // the CPU whose run queue (and lock) this proc belongs to
+    u64 affinity; // bit i set: may run on CPU i
+    bool migrating; // on the migrate_list of `cpu`
+    ListNode migrate_node;
+
+    // real-time class
+    int policy; // SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+    int rt_priority; // 1 (lowest) to RT_PRIO_MAX, 0 for SCHED_NORMAL
+    ListNode rt_node; // on the per-CPU rt_queue[rt_priority]
+    u64 rt_slice; // SCHED_RR: counter ticks left in the current round
+
+    // statistics
+    u64 wait_start; // timestamp when the proc last became runnable
+    u64 nr_voluntary;
+    u64 nr_involuntary;
+    u64 wait_hist[SCHEDSTAT_NBUCKET]; // see kernel/schedstat.h
 };
 
 typedef struct Proc {
@@ -51,10 +71,18 @@ typedef struct Proc {
 } Proc;
 
 void init_kproc();
-void init_proc(Proc *);
+WARN_RESULT int init_proc(Proc *);
 WARN_RESULT Proc *create_proc();
+
+extern struct kmem_cache *proc_cache;
 int start_proc(Proc *, void (*entry)(u64), u64 arg);
 NO_RETURN void exit(int code);
 WARN_RESULT int wait(int *exitcode);
 WARN_RESULT int kill(int pid);
+// look up a proc by pid (0 for the calling proc) and hold the process tree
+// so that it cannot be reaped until put_proc(). NULL if there is none
+WARN_RESULT Proc *get_proc(int pid);
+void put_proc(Proc *);
+// call fn on every proc in the process tree, with the tree held
+void walk_procs(void (*fn)(Proc *, void *), void *arg);
 WARN_RESULT int fork();
\ No newline at end of file
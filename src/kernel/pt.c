@@ -9,6 +9,7 @@
     @brief Return a pointer to the PTE (Page Table Entry) for virtual address 'va'
     @note If the entry not exists (NEEDN'T BE VALID), allocate it if alloc=true, or return NULL if false.
     @note THIS ROUTINUE GETS THE PTE, NOT THE PAGE DESCRIBED BY PTE.
+    @note Also returns NULL if a page table page cannot be allocated.
  */
 PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
 {
@@ -17,8 +18,9 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
         if (!alloc) {
             return NULL;
         }
-        pt0 = kalloc_page();
-        memset(pt0, 0, PAGE_SIZE);
+        pt0 = kalloc_zeroed_page();
+        if (pt0 == NULL)
+            return NULL;
         pgdir->pt = pt0;
     }
     PTEntriesPtr pt1 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt0[VA_PART0(va)]));
@@ -26,8 +28,9 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
         if (!alloc) {
             return NULL;
         }
-        pt1 = kalloc_page();
-        memset((void *)pt1, 0, PAGE_SIZE);
+        pt1 = kalloc_zeroed_page();
+        if (pt1 == NULL)
+            return NULL;
         pt0[VA_PART0(va)] = K2P(pt1) | PTE_TABLE;
     }
     PTEntriesPtr pt2 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt1[VA_PART1(va)]));
@@ -35,8 +38,9 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
         if (!alloc) {
             return NULL;
         }
-        pt2 = kalloc_page();
-        memset((void *)pt2, 0, PAGE_SIZE);
+        pt2 = kalloc_zeroed_page();
+        if (pt2 == NULL)
+            return NULL;
         pt1[VA_PART1(va)] = K2P(pt2) | PTE_TABLE;
     }
     PTEntriesPtr pt3 = (PTEntriesPtr)P2K(PTE_ADDRESS(pt2[VA_PART2(va)]));
@@ -44,8 +48,9 @@ PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc)
         if (!alloc) {
             return NULL;
         }
-        pt3 = kalloc_page();
-        memset((void *)pt3, 0, PAGE_SIZE);
+        pt3 = kalloc_zeroed_page();
+        if (pt3 == NULL)
+            return NULL;
         pt2[VA_PART2(va)] = K2P(pt3) | PTE_TABLE;
     }
     return pt3 + VA_PART3(va);
@@ -58,6 +63,7 @@ void init_pgdir(struct pgdir *pgdir)
 
     // final:
     init_spinlock(&pgdir->lock);
+    init_seqlock(&pgdir->section_lock);
     init_sections(&pgdir->section_head);
 }
 
@@ -110,16 +116,19 @@ void attach_pgdir(struct pgdir *pgdir)
 /**
  * Map virtual address 'va' to the physical address represented by kernel
  * address 'ka' in page directory 'pd', 'flags' is the flags for the page
- * table entry.
+ * table entry. Returns -1 if the page tables cannot be allocated.
  */
-void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags)
+int vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags)
 {
     /* (Final) TODO BEGIN */
     u64 pa = K2P(ka);
     PTEntriesPtr pte = get_pte(pd, va, TRUE);
-    ASSERT(pte);
+    if (pte == NULL)
+        return -1;
     *pte = PAGE_BASE(pa) | flags;
+    page_map((u64)ka);
     arch_tlbi_vmalle1is();
+    return 0;
     /* (Final) TODO END */
 }
 
@@ -136,9 +145,14 @@ int copyout(struct pgdir *pd, void *va, void *p, usize len)
         usize offset = VA_OFFSET(va);
         usize this_size = MIN(len, PAGE_SIZE - offset);
         PTEntriesPtr pte = get_pte(pd, (u64)va, TRUE);
+        if (pte == NULL)
+            return -1;
         if (*pte == NULL) {
-            void *new_page = kalloc_page();
+            void *new_page = kalloc_zeroed_page();
+            if (new_page == NULL)
+                return -1;
             *pte = K2P(new_page) | PTE_USER_DATA;
+            page_map((u64)new_page);
         }
         memcpy((void *)(P2K(PTE_ADDRESS(*pte)) + offset), p, this_size);
         size += this_size;
@@ -2,11 +2,15 @@
 
 #include <aarch64/mmu.h>
 #include <common/spinlock.h>
+#include <common/seqlock.h>
 #include <common/list.h>
 
 struct pgdir {
     PTEntriesPtr pt;
-    SpinLock lock;
+    SpinLock lock; // the page tables
+    // the section list and bounds. only the owning proc frees sections, so
+    // its own lookups may walk the list under read_seqbegin
+    SeqLock section_lock;
     ListNode section_head;
 };
 
@@ -14,5 +18,5 @@ void init_pgdir(struct pgdir *pgdir);
 WARN_RESULT PTEntriesPtr get_pte(struct pgdir *pgdir, u64 va, bool alloc);
 void free_pgdir(struct pgdir *pgdir);
 void attach_pgdir(struct pgdir *pgdir);
-void vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags);
-int copyout(struct pgdir *pd, void *va, void *p, usize len);
\ No newline at end of file
+WARN_RESULT int vmmap(struct pgdir *pd, u64 va, void *ka, u64 flags);
+WARN_RESULT int copyout(struct pgdir *pd, void *va, void *p, usize len);
\ No newline at end of file
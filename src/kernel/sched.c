@@ -5,22 +5,52 @@
 #include <aarch64/intrinsic.h>
 #include <kernel/cpu.h>
 #include <common/rbtree.h>
+#include <common/string.h>
 #include <driver/clock.h>
+#include <driver/gicv3.h>
+#include <driver/interrupt.h>
 
 #define TIMESLICE 2
+// tick of a proc that has its CPU to itself. the first proc queued behind
+// it brings the tick in to TIMESLICE
+#define LONE_TIMESLICE 50
+// the scheduler tick may come up to 1/TICK_SLACK of its period late
+#define TICK_SLACK 8
+// sleeps may end up to SLEEP_SLACK_US late, to share wakeup interrupts
+#define SLEEP_SLACK_US 50
+// a woken fair proc preempts one at least WAKEUP_GRAN ms of vruntime ahead
+#define WAKEUP_GRAN 1
+
+// SCHED_RR procs of equal priority take turns every RR_TIMESLICE ms
+#define RR_TIMESLICE 20
+// throttling: RT procs together get at most RT_RUNTIME ms of every RT_PERIOD
+// ms on a CPU when fair procs are waiting
+#define RT_PERIOD 1000
+#define RT_RUNTIME 950
 
 extern bool panic_flag;
 
 extern void swtch(KernelContext *new_ctx, KernelContext **old_ctx);
 
-static SpinLock rqlock;
-static struct rb_root_ rq;
 static struct timer sched_timer[NCPU];
 
+/**
+ * weight of each nice level, from -20 to 19. every step is about 1.25x, so
+ * one nice level apart means roughly 10% more or less CPU time. vruntime
+ * advances by runtime * NICE_0_WEIGHT / weight.
+ */
+#define NICE_0_WEIGHT 1024
+static const u32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
 static bool __timer_cmp(rb_node lnode, rb_node rnode)
 {
-    i64 d = container_of(lnode, struct schinfo, rq)->runtime -
-            container_of(rnode, struct schinfo, rq)->runtime;
+    i64 d = container_of(lnode, struct schinfo, rq)->vruntime -
+            container_of(rnode, struct schinfo, rq)->vruntime;
     if (d < 0)
         return true;
     if (d == 0)
@@ -28,20 +58,59 @@ static bool __timer_cmp(rb_node lnode, rb_node rnode)
     return false;
 }
 
+static void arm_tick(u64 ms);
+
+// another CPU queued a proc that should run here, or one that only needs a
+// shorter tick
+static void resched_handler(u32 intid)
+{
+    (void)intid;
+    struct sched *s = &cpus[cpuid()].sched;
+    acquire_sched_lock();
+    if (s->retick) {
+        s->retick = false;
+        if (!s->need_resched && !s->nr_migrating && !thisproc()->idle) {
+            arm_tick(TIMESLICE);
+            release_sched_lock();
+            return;
+        }
+    }
+    sched(RUNNABLE);
+}
+
 void init_sched()
 {
     // TODO: initialize the scheduler
     // 1. initialize the resources (e.g. locks, semaphores)
     // 2. initialize the scheduler info of each CPU
-    init_spinlock(&rqlock);
-
     for (int i = 0; i != NCPU; i++) {
-        Proc *p = kalloc(sizeof(Proc));
-        p->killed = FALSE;
+        struct sched *s = &cpus[i].sched;
+        init_spinlock(&s->lock);
+        s->rq.rb_node = NULL;
+        s->nr_running = 0;
+        s->min_vruntime = 0;
+        for (int j = 0; j <= RT_PRIO_MAX; j++)
+            init_list_node(&s->rt_queue[j]);
+        s->rt_bitmap[0] = s->rt_bitmap[1] = 0;
+        s->nr_rt = 0;
+        s->rt_period_start = s->rt_time = 0;
+        init_list_node(&s->migrate_list);
+        s->nr_migrating = 0;
+        s->need_resched = s->lone_tick = s->retick = false;
+        s->woken = s->handoff = NULL;
+        Proc *p = kmem_cache_alloc(proc_cache);
+        ASSERT(p);
+        // the accounting reads every schinfo field, idle time from now on
+        memset(p, 0, sizeof(Proc));
+        init_schinfo(&p->schinfo);
         p->idle = true;
         p->state = RUNNING;
-        cpus[i].sched.thisproc = cpus[i].sched.idle = p;
+        p->schinfo.cpu = i;
+        p->schinfo.affinity = BIT(i);
+        p->schinfo.exec_start = get_timestamp();
+        s->thisproc = s->idle = p;
     }
+    set_interrupt_handler(RESCHED_SGI, resched_handler);
 }
 
 Proc *thisproc()
@@ -50,39 +119,399 @@ Proc *thisproc()
     return cpus[cpuid()].sched.thisproc;
 }
 
+// the least loaded CPU in `affinity`. nr_running is read without the locks,
+// so the choice is only a hint
+static int least_loaded_cpu(u64 affinity)
+{
+    int target = -1;
+    for (int i = 0; i != NCPU; i++)
+        if ((affinity & BIT(i)) &&
+            (target < 0 ||
+             cpus[i].sched.nr_running < cpus[target].sched.nr_running))
+            target = i;
+    ASSERT(target >= 0);
+    return target;
+}
+
 void init_schinfo(struct schinfo *p)
 {
     // TODO: initialize your customized schinfo for every newly-created process
     p->runtime = 0;
+    p->vruntime = 0;
+    p->nice = 0;
+    p->policy = SCHED_NORMAL;
+    p->rt_priority = 0;
+    init_list_node(&p->rt_node);
+    p->rt_slice = 0;
+    p->affinity = BIT(NCPU) - 1;
+    p->migrating = false;
+    init_list_node(&p->migrate_node);
+    p->nr_voluntary = p->nr_involuntary = 0;
+    for (int i = 0; i != SCHEDSTAT_NBUCKET; i++)
+        p->wait_hist[i] = 0;
+    // new procs start on the least loaded CPU they may run on. nobody else
+    // can see the proc yet
+    p->cpu = least_loaded_cpu(p->affinity);
 }
 
+// the sched lock is the lock of the current CPU's run queue, which covers
+// thisproc()
 void acquire_sched_lock()
 {
     // TODO: acquire the sched_lock if need
-    acquire_spinlock(&rqlock);
+    acquire_spinlock(&cpus[cpuid()].sched.lock);
 }
 
 void release_sched_lock()
 {
     // TODO: release the sched_lock if need
-    release_spinlock(&rqlock);
+    release_spinlock(&cpus[cpuid()].sched.lock);
+}
+
+// lock the run queue p belongs to. p may be stolen by another CPU while we
+// wait for the lock, so check again once it is held
+static struct sched *lock_proc_rq(Proc *p)
+{
+    while (1) {
+        int cpu = p->schinfo.cpu;
+        struct sched *s = &cpus[cpu].sched;
+        acquire_spinlock(&s->lock);
+        if (p->schinfo.cpu == cpu)
+            return s;
+        release_spinlock(&s->lock);
+    }
+}
+
+static INLINE bool is_rt(Proc *p)
+{
+    return p->schinfo.policy != SCHED_NORMAL;
+}
+
+
+// call with s->lock. RT procs go to the tail of their priority list, or to
+// the head if they were preempted before their turn was over
+static void enqueue_proc(struct sched *s, Proc *p, bool head)
+{
+    if (is_rt(p)) {
+        int prio = p->schinfo.rt_priority;
+        ListNode *q = &s->rt_queue[prio];
+        _insert_into_list(head ? q : q->prev, &p->schinfo.rt_node);
+        s->rt_bitmap[prio / 64] |= 1ull << (prio % 64);
+        s->nr_rt++;
+    } else {
+        bool check_insert =
+                _rb_insert(&p->schinfo.rq, &s->rq, __timer_cmp) == 0;
+        ASSERT(check_insert);
+    }
+    s->nr_running++;
+}
+
+// call with s->lock
+static void dequeue_proc(struct sched *s, Proc *p)
+{
+    if (is_rt(p)) {
+        int prio = p->schinfo.rt_priority;
+        _detach_from_list(&p->schinfo.rt_node);
+        if (_empty_list(&s->rt_queue[prio]))
+            s->rt_bitmap[prio / 64] &= ~(1ull << (prio % 64));
+        s->nr_rt--;
+    } else {
+        _rb_erase(&p->schinfo.rq, &s->rq);
+    }
+    s->nr_running--;
+    // once off the queue p may run, exit and be freed
+    if (s->woken == p)
+        s->woken = NULL;
+}
+
+static INLINE bool cpu_allowed(Proc *p, int cpu)
+{
+    return (p->schinfo.affinity & BIT(cpu)) != 0;
+}
+
+// call with the locks of both run queues
+static void move_proc(struct sched *from, int to_cpu, Proc *p)
+{
+    struct sched *to = &cpus[to_cpu].sched;
+    // keep its lag relative to the queue it moves to
+    p->schinfo.vruntime += to->min_vruntime - from->min_vruntime;
+    p->schinfo.cpu = to_cpu;
+    enqueue_proc(to, p, false);
+}
+
+// the vruntime of a fair proc running right now, counting the time since
+// update_curr last charged it. call with the lock of its run queue
+static INLINE u64 running_vruntime(Proc *cur)
+{
+    u64 delta = get_timestamp() - cur->schinfo.exec_start;
+    return cur->schinfo.vruntime +
+           delta * NICE_0_WEIGHT / nice_to_weight[cur->schinfo.nice - NICE_MIN];
+}
+
+// whether p, just made runnable, should take the CPU from cur. a fair
+// proc must be WAKEUP_GRAN behind in vruntime, so that two procs waking
+// each other do not switch on every wakeup
+static INLINE bool preempts(Proc *cur, Proc *p)
+{
+    if (cur->idle)
+        return true;
+    if (is_rt(p))
+        return !is_rt(cur) || p->schinfo.rt_priority > cur->schinfo.rt_priority;
+    return !is_rt(cur) &&
+           (i64)(running_vruntime(cur) - p->schinfo.vruntime) >
+                   (i64)ms_to_ticks(WAKEUP_GRAN);
+}
+
+/**
+ * tell the CPUs about p, just woken onto the queue of cpu. if p should
+ * preempt what that CPU runs, mark it for resched, and interrupt it unless
+ * it is us: we switch on our way out of the trap. otherwise interrupt an
+ * idle CPU p may run on, which will steal it; RT procs are never stolen,
+ * so they wait for their own CPU. call with the lock of cpu
+ */
+static void kick_cpus(int cpu, Proc *p)
+{
+    int this_cpu = cpuid();
+    struct sched *s = &cpus[cpu].sched;
+    if (preempts(s->thisproc, p)) {
+        s->need_resched = true;
+        if (cpu != this_cpu)
+            gic_send_sgi(cpu, RESCHED_SGI);
+        return;
+    }
+    if (s->lone_tick) {
+        s->lone_tick = false;
+        if (cpu == this_cpu) {
+            arm_tick(TIMESLICE);
+        } else {
+            s->retick = true;
+            gic_send_sgi(cpu, RESCHED_SGI);
+        }
+    }
+    if (is_rt(p))
+        return;
+    for (int i = 0; i != NCPU; i++) {
+        if (i != this_cpu && cpus[i].online && cpu_allowed(p, i) &&
+            cpus[i].sched.thisproc->idle) {
+            gic_send_sgi(i, RESCHED_SGI);
+            return;
+        }
+    }
+}
+
+
+/**
+ * send a runnable proc that may not run on s to the least loaded CPU it
+ * may run on. we hold s->lock, so the target's lock is only tried; if that
+ * fails, or if the proc may still be executing (its context is saved only
+ * when sched() returns), it waits on s->migrate_list until push_migrating.
+ * call with s->lock
+ */
+static void migrate_proc(struct sched *s, Proc *p, bool context_saved)
+{
+    int target = least_loaded_cpu(p->schinfo.affinity);
+    if (context_saved && try_acquire_spinlock(&cpus[target].sched.lock)) {
+        move_proc(s, target, p);
+        kick_cpus(target, p);
+        release_spinlock(&cpus[target].sched.lock);
+        return;
+    }
+    p->schinfo.migrating = true;
+    _insert_into_list(s->migrate_list.prev, &p->schinfo.migrate_node);
+    s->nr_migrating++;
+    // the list is only drained from sched() on the CPU owning it, which may
+    // be idle with no tick. interrupt it, even if that is us
+    gic_send_sgi(p->schinfo.cpu, RESCHED_SGI);
+}
+
+// call with s->lock
+static void unlink_migrating(struct sched *s, Proc *p)
+{
+    _detach_from_list(&p->schinfo.migrate_node);
+    p->schinfo.migrating = false;
+    s->nr_migrating--;
+}
+
+// retry the procs parked on our migrate_list. call with the sched lock,
+// before thisproc() can be parked there
+static void push_migrating(struct sched *s)
+{
+    for (int n = s->nr_migrating; n > 0; n--) {
+        Proc *p = container_of(s->migrate_list.next, Proc, schinfo.migrate_node);
+        unlink_migrating(s, p);
+        migrate_proc(s, p, true);
+    }
+}
+
+// queue a runnable proc on s, or send it to a CPU its affinity allows.
+// call with s->lock
+static void queue_proc(struct sched *s, Proc *p, bool head, bool context_saved)
+{
+    if (cpu_allowed(p, p->schinfo.cpu))
+        enqueue_proc(s, p, head);
+    else
+        migrate_proc(s, p, context_saved);
+}
+
+// the first proc of the highest non-empty RT priority, or NULL
+static Proc *first_rt(struct sched *s)
+{
+    for (int i = 1; i >= 0; i--) {
+        if (s->rt_bitmap[i]) {
+            int prio = i * 64 + 63 - __builtin_clzll(s->rt_bitmap[i]);
+            return container_of(s->rt_queue[prio].next, Proc, schinfo.rt_node);
+        }
+    }
+    return NULL;
+}
+
+// whether RT procs used up their share of the current period. call with
+// s->lock
+static bool rt_throttled(struct sched *s)
+{
+    u64 now = get_timestamp();
+    if (now - s->rt_period_start >= ms_to_ticks(RT_PERIOD)) {
+        s->rt_period_start = now;
+        s->rt_time = 0;
+    }
+    return s->rt_time >= ms_to_ticks(RT_RUNTIME);
+}
+
+// charge the time thisproc has run since exec_start. call with the sched lock
+static void update_curr(Proc *p)
+{
+    u64 now = get_timestamp();
+    u64 delta = now - p->schinfo.exec_start;
+    p->schinfo.exec_start = now;
+    if (p->idle) {
+        cpus[cpuid()].idle_time += delta;
+        return;
+    }
+    cpus[cpuid()].busy_time += delta;
+    p->schinfo.runtime += delta;
+    if (is_rt(p)) {
+        cpus[cpuid()].sched.rt_time += delta;
+        p->schinfo.rt_slice -= MIN(delta, p->schinfo.rt_slice);
+        return;
+    }
+    p->schinfo.vruntime +=
+            delta * NICE_0_WEIGHT / nice_to_weight[p->schinfo.nice - NICE_MIN];
+}
+
+// call with s->lock
+static void update_min_vruntime(struct sched *s)
+{
+    rb_node first = _rb_first(&s->rq);
+    if (first) {
+        u64 v = container_of(first, struct schinfo, rq)->vruntime;
+        if ((i64)(v - s->min_vruntime) > 0)
+            s->min_vruntime = v;
+    }
+}
+
+/**
+ * a proc joining s->rq must not keep a vruntime far below the others, or it
+ * would monopolize the CPU. newcomers start at min_vruntime; wakers get up
+ * to one timeslice of credit so interactive procs still run promptly.
+ * call with s->lock
+ */
+static void place_proc(struct sched *s, Proc *p, bool new)
+{
+    u64 credit = new ? 0 : ms_to_ticks(TIMESLICE);
+    u64 floor = s->min_vruntime - MIN(credit, s->min_vruntime);
+    if (new || (i64)(p->schinfo.vruntime - floor) < 0)
+        p->schinfo.vruntime = floor;
+}
+
+void set_proc_nice(Proc *p, int nice)
+{
+    struct sched *s = lock_proc_rq(p);
+    p->schinfo.nice = MAX(NICE_MIN, MIN(NICE_MAX, nice));
+    release_spinlock(&s->lock);
+}
+
+int get_proc_nice(Proc *p)
+{
+    return p->schinfo.nice;
+}
+
+bool set_proc_policy(Proc *p, int policy, int rt_priority)
+{
+    if (policy == SCHED_NORMAL ? rt_priority != 0
+                               : (policy != SCHED_FIFO && policy != SCHED_RR) ||
+                                         rt_priority < 1 ||
+                                         rt_priority > RT_PRIO_MAX)
+        return false;
+    struct sched *s = lock_proc_rq(p);
+    // a queued proc moves to the queue of its new class. parked procs pick
+    // their class when they are queued again
+    bool queued = p->state == RUNNABLE && !p->schinfo.migrating;
+    if (queued)
+        dequeue_proc(s, p);
+    if (is_rt(p) && policy == SCHED_NORMAL)
+        place_proc(s, p, false);
+    p->schinfo.policy = policy;
+    p->schinfo.rt_priority = rt_priority;
+    p->schinfo.rt_slice = ms_to_ticks(RR_TIMESLICE);
+    if (queued)
+        enqueue_proc(s, p, false);
+    release_spinlock(&s->lock);
+    return true;
+}
+
+bool set_proc_affinity(Proc *p, u64 mask)
+{
+    mask &= BIT(NCPU) - 1;
+    if (!mask)
+        return false;
+    struct sched *s = lock_proc_rq(p);
+    p->schinfo.affinity = mask;
+    bool allowed = cpu_allowed(p, p->schinfo.cpu);
+    // a proc not started yet is on no queue: just start it somewhere allowed
+    if (p->state == UNUSED && !allowed) {
+        p->schinfo.cpu = least_loaded_cpu(mask);
+        release_spinlock(&s->lock);
+        return true;
+    }
+    if (p->state == RUNNABLE && !p->schinfo.migrating && !allowed) {
+        dequeue_proc(s, p);
+        migrate_proc(s, p, true);
+    } else if (p->schinfo.migrating && allowed) {
+        unlink_migrating(s, p);
+        enqueue_proc(s, p, false);
+    }
+    // a running proc moves when it next goes through sched()
+    release_spinlock(&s->lock);
+    return true;
+}
+
+u64 get_proc_affinity(Proc *p)
+{
+    return p->schinfo.affinity;
+}
+
+int get_proc_policy(Proc *p, int *rt_priority)
+{
+    if (rt_priority)
+        *rt_priority = p->schinfo.rt_priority;
+    return p->schinfo.policy;
 }
 
 bool is_zombie(Proc *p)
 {
     bool r;
-    acquire_sched_lock();
+    struct sched *s = lock_proc_rq(p);
     r = p->state == ZOMBIE;
-    release_sched_lock();
+    release_spinlock(&s->lock);
     return r;
 }
 
 bool is_unused(Proc *p)
 {
     bool r;
-    acquire_sched_lock();
+    struct sched *s = lock_proc_rq(p);
     r = p->state == UNUSED;
-    release_sched_lock();
+    release_spinlock(&s->lock);
     return r;
 }
 
@@ -92,26 +521,40 @@ bool _activate_proc(Proc *p, bool onalert)
     // if the proc->state is RUNNING/RUNNABLE, do nothing and return false
     // if the proc->state is SLEEPING/UNUSED, set the process state to RUNNABLE, add it to the sched queue, and return true
     // if the proc->state is DEEPSLEEPING, do nothing if onalert or activate it if else, and return the corresponding value.
-    acquire_sched_lock();
+    // the proc is woken on the CPU it last ran on; idle CPUs steal it if
+    // that one is busy
+    struct sched *s = lock_proc_rq(p);
     bool ret = false;
     if (p->state == RUNNING || p->state == RUNNABLE) {
-        release_sched_lock();
+        release_spinlock(&s->lock);
         return ret;
     } else if (p->state == SLEEPING || p->state == UNUSED) {
+        place_proc(s, p, p->state == UNUSED);
         p->state = RUNNABLE;
-        ret = _rb_insert(&p->schinfo.rq, &rq, __timer_cmp) == 0;
+        queue_proc(s, p, false, true);
+        ret = true;
     } else if (p->state == DEEPSLEEPING) {
         if (onalert) {
-            release_sched_lock();
+            release_spinlock(&s->lock);
             return ret;
         } else {
+            place_proc(s, p, false);
             p->state = RUNNABLE;
-            ret = _rb_insert(&p->schinfo.rq, &rq, __timer_cmp);
+            queue_proc(s, p, false, true);
+            ret = true;
         }
     } else {
         PANIC();
     }
-    release_sched_lock();
+    if (ret)
+        p->schinfo.wait_start = get_timestamp();
+    // procs sent to another queue were kicked by migrate_proc
+    if (ret && !p->schinfo.migrating && &cpus[p->schinfo.cpu].sched == s) {
+        kick_cpus(p->schinfo.cpu, p);
+        if (p->schinfo.cpu == (int)cpuid())
+            s->woken = p;
+    }
+    release_spinlock(&s->lock);
     return ret;
 }
 
@@ -119,62 +562,224 @@ static void update_this_state(enum procstate new_state)
 {
     // TODO: if you use template sched function, you should implement this routinue
     // update the state of current process to new_state, and modify the sched queue if necessary
+    struct sched *s = &cpus[cpuid()].sched;
     if (new_state == RUNNABLE && !thisproc()->idle) {
-        bool check_insert = _rb_insert(&thisproc()->schinfo.rq, &rq, __timer_cmp) == 0;
-        ASSERT(check_insert);
+        Proc *p = thisproc();
+        // SCHED_FIFO keeps the CPU until it blocks; SCHED_RR goes behind
+        // its peers once its round is over
+        bool head = p->schinfo.policy == SCHED_FIFO ||
+                    (p->schinfo.policy == SCHED_RR && p->schinfo.rt_slice);
+        if (p->schinfo.policy == SCHED_RR && !p->schinfo.rt_slice)
+            p->schinfo.rt_slice = ms_to_ticks(RR_TIMESLICE);
+        p->schinfo.wait_start = get_timestamp();
+        queue_proc(s, p, head, false);
     }
     if ((new_state == SLEEPING || new_state == DEEPSLEEPING ||new_state == ZOMBIE) &&
         (thisproc()->state == RUNNABLE)) {
-        _rb_erase(&thisproc()->schinfo.rq, &rq);
+        dequeue_proc(s, thisproc());
     }
     thisproc()->state = new_state;
 }
 
+/**
+ * pull one runnable proc from the busiest other CPU into our run queue.
+ * we already hold our own lock, so the victim's lock is only tried: two
+ * idle CPUs stealing from each other must not deadlock.
+ * call with the sched lock.
+ */
+static Proc *steal_proc(struct sched *this_rq)
+{
+    int this_cpu = cpuid();
+    int busiest = -1, most = 0;
+    // only fair procs can be stolen, so only they count
+    for (int i = 0; i != NCPU; i++) {
+        int nr_fair = cpus[i].sched.nr_running - cpus[i].sched.nr_rt;
+        if (i == this_cpu || nr_fair <= most)
+            continue;
+        busiest = i;
+        most = nr_fair;
+    }
+    if (busiest < 0)
+        return NULL;
+    struct sched *s = &cpus[busiest].sched;
+    if (!try_acquire_spinlock(&s->lock))
+        return NULL;
+    Proc *p = NULL;
+    // RT procs stay where they were woken; only fair procs migrate
+    rb_node node = _rb_first(&s->rq);
+    if (node) {
+        p = container_of(node, Proc, schinfo.rq);
+        if (cpu_allowed(p, this_cpu)) {
+            dequeue_proc(s, p);
+            move_proc(s, this_cpu, p);
+        } else {
+            p = NULL;
+        }
+    }
+    release_spinlock(&s->lock);
+    return p;
+}
+
+// take a proc parked on another CPU's migrate_list that may run here
+static Proc *pull_migrating()
+{
+    int this_cpu = cpuid();
+    for (int i = 0; i != NCPU; i++) {
+        struct sched *s = &cpus[i].sched;
+        if (i == this_cpu || !s->nr_migrating ||
+            !try_acquire_spinlock(&s->lock))
+            continue;
+        _for_in_list(node, &s->migrate_list)
+        {
+            if (node == &s->migrate_list)
+                continue;
+            Proc *p = container_of(node, Proc, schinfo.migrate_node);
+            if (cpu_allowed(p, this_cpu)) {
+                unlink_migrating(s, p);
+                move_proc(s, this_cpu, p);
+                release_spinlock(&s->lock);
+                return p;
+            }
+        }
+        release_spinlock(&s->lock);
+    }
+    return NULL;
+}
+
 static Proc *pick_next()
 {
     // TODO: if using template sched function, you should implement this routinue
     // choose the next process to run, and return idle if no runnable process
+    struct sched *s = &cpus[cpuid()].sched;
     if (panic_flag)
-        return cpus[cpuid()].sched.idle;
-    rb_node next = _rb_first(&rq);
+        return s->idle;
+    // RT procs first, unless they are throttled and fair procs are waiting
+    Proc *rt = first_rt(s);
+    if (rt && (!rt_throttled(s) || s->nr_running == s->nr_rt))
+        return rt;
+    rb_node next = _rb_first(&s->rq);
     if (next) {
         auto proc = container_of(next, Proc, schinfo.rq);
         return proc;
     }
-    return cpus[cpuid()].sched.idle;
+    Proc *stolen = pull_migrating();
+    if (!stolen)
+        stolen = steal_proc(s);
+    if (stolen)
+        return stolen;
+    return s->idle;
+}
+
+static void sleep_timer_handler(struct timer *t)
+{
+    activate_proc((Proc *)t->data);
+    // the sleeper may return, and its timer go away, once data is clear
+    __atomic_store_n(&t->data, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * sleep on a timer of this CPU for `ticks` counter ticks. returns the ticks
+ * left when woken early, which only happens when the proc is killed
+ */
+u64 sleep_for(u64 ticks)
+{
+    struct timer t;
+    t.elapse = ticks;
+    t.slack = us_to_ticks(SLEEP_SLACK_US);
+    t.handler = sleep_timer_handler;
+    t.data = (u64)thisproc();
+    u64 deadline = get_timestamp() + ticks;
+    acquire_sched_lock();
+    set_cpu_timer(&t);
+    sched(SLEEPING);
+    if (!cancel_cpu_timer(&t)) {
+        while (__atomic_load_n(&t.data, __ATOMIC_ACQUIRE))
+            arch_yield();
+    }
+    u64 now = get_timestamp();
+    return now < deadline ? deadline - now : 0;
 }
 
 static void _sched_handler(struct timer *t)
 {
     t->data--;
-    thisproc()->schinfo.runtime += TIMESLICE;
     acquire_sched_lock();
     sched(RUNNABLE);
 }
 
-static void update_this_proc(Proc *p)
+static int wait_bucket(u64 us)
+{
+    int b = 0;
+    for (u64 limit = 10; b < SCHEDSTAT_NBUCKET - 1 && us >= limit; limit *= 10)
+        b++;
+    return b;
+}
+
+// record how long p waited runnable before getting the CPU at `now`
+static void account_wait(Proc *p, u64 now)
+{
+    int b = wait_bucket(ticks_to_us(now - p->schinfo.wait_start));
+    p->schinfo.wait_hist[b]++;
+    cpus[cpuid()].wait_hist[b]++;
+}
+
+// stop this CPU's scheduler tick. call with the sched lock
+static void cancel_tick()
 {
-    // TODO: you should implement this routinue
-    // update thisproc to the choosen process
-    // reset_clock(1000);
     if (sched_timer[cpuid()].data > 0) {
         cancel_cpu_timer(&sched_timer[cpuid()]);
         sched_timer[cpuid()].data--;
     }
+}
 
-    cpus[cpuid()].sched.thisproc = p;
-
-    sched_timer[cpuid()].elapse = TIMESLICE;
+// (re)arm this CPU's scheduler tick `ms` from now. call with the sched lock
+static void arm_tick(u64 ms)
+{
+    cancel_tick();
+    sched_timer[cpuid()].elapse = ms_to_ticks(ms);
+    sched_timer[cpuid()].slack = sched_timer[cpuid()].elapse / TICK_SLACK;
     sched_timer[cpuid()].handler = _sched_handler;
-
     set_cpu_timer(&sched_timer[cpuid()]);
     sched_timer[cpuid()].data++;
+}
+
+// a handoff keeps the running tick: p gets what is left of the slice
+static void update_this_proc(Proc *p, bool handoff)
+{
+    // TODO: you should implement this routinue
+    // update thisproc to the choosen process
+    // reset_clock(1000);
+    struct sched *s = &cpus[cpuid()].sched;
+    if (handoff) {
+        s->thisproc = p;
+        p->schinfo.exec_start = get_timestamp();
+        dequeue_proc(s, p);
+        account_wait(p, p->schinfo.exec_start);
+        // the yielder now waits behind p
+        if (s->lone_tick && s->nr_running) {
+            s->lone_tick = false;
+            arm_tick(TIMESLICE);
+        }
+        return;
+    }
+    cancel_tick();
+    s->lone_tick = s->retick = false;
+
+    s->thisproc = p;
+    p->schinfo.exec_start = get_timestamp();
 
     ASSERT(p->state == RUNNABLE);
 
     if (!p->idle) {
-        _rb_erase(&p->schinfo.rq, &rq);
+        dequeue_proc(s, p);
+        account_wait(p, p->schinfo.exec_start);
     }
+
+    // the idle proc needs no tick: it enters sched() whenever it wakes up
+    if (p->idle)
+        return;
+    s->lone_tick = !s->nr_running;
+    arm_tick(s->lone_tick ? LONE_TIMESLICE : TIMESLICE);
 }
 
 // A simple scheduler.
@@ -183,26 +788,114 @@ static void update_this_proc(Proc *p)
 void sched(enum procstate new_state)
 {
     auto this = thisproc();
+    struct sched *s = &cpus[cpuid()].sched;
     ASSERT(this->state == RUNNING);
+    s->need_resched = false;
+    Proc *handoff = s->handoff;
+    s->handoff = NULL;
     if (this->killed && new_state != ZOMBIE) {
         release_sched_lock();
         return;
     }
+    update_curr(this);
+    push_migrating(s);
     update_this_state(new_state);
-    auto next = pick_next();
-    update_this_proc(next);
+    update_min_vruntime(s);
+    auto next = handoff ? handoff : pick_next();
+    update_this_proc(next, handoff != NULL);
     ASSERT(next->state == RUNNABLE);
     next->state = RUNNING;
     if (next != this) {
+        cpus[cpuid()].nr_switches++;
+        if (this->state == RUNNABLE)
+            this->schinfo.nr_involuntary++;
+        else
+            this->schinfo.nr_voluntary++;
         attach_pgdir(&next->pgdir);
         swtch(next->kcontext, &this->kcontext);
     }
     release_sched_lock();
 }
 
+void check_resched()
+{
+    if (cpus[cpuid()].sched.need_resched)
+        yield();
+}
+
+void yield_to(Proc *p)
+{
+    struct sched *s = &cpus[cpuid()].sched;
+    acquire_sched_lock();
+    Proc *this = thisproc();
+    // p may have run, exited and been freed since we woke it, so compare
+    // before touching it: s->woken is still on our queue, as dequeue_proc
+    // clears it under our lock. RT procs keep their strict order, so
+    // handoffs are between fair procs only
+    if (p != s->woken || this->idle || is_rt(this) || is_rt(p) || s->nr_rt ||
+        panic_flag) {
+        release_sched_lock();
+        return;
+    }
+    s->handoff = p;
+    sched(RUNNABLE);
+}
+
 u64 proc_entry(void (*entry)(u64), u64 arg)
 {
     release_sched_lock();
     set_return_addr(entry);
     return arg;
 }
+
+static void fill_proc_stat(Proc *p, void *arg)
+{
+    struct schedstat *st = arg;
+    if (p->state == UNUSED || st->nr_procs == SCHEDSTAT_MAX_PROCS)
+        return;
+    struct schedstat_proc *ps = &st->procs[st->nr_procs++];
+    ps->pid = p->pid;
+    ps->state = p->state;
+    ps->cpu = p->schinfo.cpu;
+    ps->nice = p->schinfo.nice;
+    ps->policy = p->schinfo.policy;
+    ps->rt_priority = p->schinfo.rt_priority;
+    ps->runtime_us = ticks_to_us(p->schinfo.runtime);
+    ps->nr_voluntary = p->schinfo.nr_voluntary;
+    ps->nr_involuntary = p->schinfo.nr_involuntary;
+    for (int i = 0; i != SCHEDSTAT_NBUCKET; i++)
+        ps->wait_hist[i] = p->schinfo.wait_hist[i];
+}
+
+/**
+ * the counters are read without the run queue locks, so a snapshot may be
+ * slightly inconsistent. the time since each CPU last entered sched() is
+ * charged to its current proc here, or a long idle stretch would not show.
+ */
+void get_schedstat(struct schedstat *st)
+{
+    memset(st, 0, sizeof(struct schedstat));
+    st->uptime_ms = get_timestamp_ms();
+    u64 now = get_timestamp();
+    for (int i = 0; i != NCPU; i++) {
+        struct cpu *c = &cpus[i];
+        struct schedstat_cpu *cs = &st->cpus[i];
+        u64 busy = c->busy_time, idle = c->idle_time;
+        if (c->online) {
+            Proc *cur = c->sched.thisproc;
+            u64 open = now - MIN(now, cur->schinfo.exec_start);
+            if (cur->idle)
+                idle += open;
+            else
+                busy += open;
+        }
+        cs->busy_us = ticks_to_us(busy);
+        cs->idle_us = ticks_to_us(idle);
+        cs->nr_switches = c->nr_switches;
+        cs->nr_timer_irqs = c->nr_timer_irqs;
+        cs->nr_running = c->sched.nr_running;
+        for (int j = 0; j != SCHEDSTAT_NBUCKET; j++)
+            cs->wait_hist[j] = c->wait_hist[j];
+    }
+    walk_procs(fill_proc_stat, st);
+}
@@ -2,6 +2,14 @@
 
 #include <kernel/proc.h>
 
+#define NICE_MIN -20
+#define NICE_MAX 19
+
+// scheduling policies, with the Linux numbering
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+
 void init_sched();
 void init_schinfo(struct schinfo *);
 
@@ -17,5 +25,25 @@ void sched(enum procstate new_state);
 
 // MUST call lock_for_sched() before sched() !!!
 #define yield() (acquire_sched_lock(), sched(RUNNABLE))
+// yield if a wakeup marked this CPU for resched. called on trap return
+void check_resched();
+// directed yield: run p, which we just woke, now for the rest of our slice.
+// do nothing unless p still waits on this CPU's queue and may get ahead of us
+void yield_to(Proc *p);
 
 WARN_RESULT Proc *thisproc();
+
+void set_proc_nice(Proc *, int nice);
+WARN_RESULT int get_proc_nice(Proc *);
+// rt_priority must be 1..RT_PRIO_MAX for SCHED_FIFO/SCHED_RR and 0 for
+// SCHED_NORMAL. returns false if the arguments are invalid
+WARN_RESULT bool set_proc_policy(Proc *, int policy, int rt_priority);
+int get_proc_policy(Proc *, int *rt_priority);
+// restrict the proc to the CPUs in `mask`; false if no such CPU exists
+WARN_RESULT bool set_proc_affinity(Proc *, u64 mask);
+WARN_RESULT u64 get_proc_affinity(Proc *);
+
+void get_schedstat(struct schedstat *);
+
+// sleep for `ticks` timer counter ticks; the ticks left if woken early
+u64 sleep_for(u64 ticks);
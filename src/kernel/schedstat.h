@@ -0,0 +1,45 @@
+#pragma once
+
+#include <common/defines.h>
+
+/**
+ * the snapshot returned by the schedstat syscall. it is shared with user
+ * programs, so it only uses fixed-size fields. times are in microseconds.
+ */
+
+#define SCHEDSTAT_NCPU 4 // == NCPU
+#define SCHEDSTAT_MAX_PROCS 64
+// runnable wait histogram: bucket i counts waits below 10^(i+1) us, the
+// last one everything longer
+#define SCHEDSTAT_NBUCKET 6
+
+struct schedstat_cpu {
+    u64 busy_us;
+    u64 idle_us; // time the idle proc held the CPU
+    u64 nr_switches;
+    u64 nr_timer_irqs;
+    u64 nr_running; // procs waiting in the run queue
+    u64 wait_hist[SCHEDSTAT_NBUCKET];
+};
+
+struct schedstat_proc {
+    int pid;
+    int state; // enum procstate
+    int cpu;
+    int nice;
+    int policy;
+    int rt_priority;
+    u64 runtime_us;
+    u64 nr_voluntary; // switched out to sleep or exit
+    u64 nr_involuntary; // switched out while still runnable
+    u64 wait_hist[SCHEDSTAT_NBUCKET];
+};
+
+struct schedstat {
+    u64 uptime_ms;
+    struct schedstat_cpu cpus[SCHEDSTAT_NCPU];
+
+    // live procs, in process tree order
+    u64 nr_procs;
+    struct schedstat_proc procs[SCHEDSTAT_MAX_PROCS];
+};
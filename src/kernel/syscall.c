@@ -46,18 +46,24 @@ void syscall_entry(UserContext *context)
 bool user_readable(const void *start, usize size)
 {
     /* (Final) TODO BEGIN */
-    bool ret = FALSE;
-    ListNode head = thisproc()->pgdir.section_head;
-    _for_in_list(node, &head)
-    {
-        if (node == &head)
-            continue;
-        auto st = container_of(node, struct section, stnode);
-        if (st->begin <= (u64)start && ((u64)start + size) <= st->end) {
-            ret = true;
-            break;
+    bool ret;
+    struct pgdir *pd = &thisproc()->pgdir;
+    u32 seq;
+    do {
+        seq = read_seqbegin(&pd->section_lock);
+        ret = FALSE;
+        _for_in_list(node, &pd->section_head)
+        {
+            if (node == &pd->section_head)
+                continue;
+            auto st = container_of(node, struct section, stnode);
+            if (st->begin <= (u64)start && (u64)start + size >= (u64)start &&
+                ((u64)start + size) <= st->end) {
+                ret = true;
+                break;
+            }
         }
-    }
+    } while (read_seqretry(&pd->section_lock, seq));
     return ret;
     /* (Final) TODO END */
 }
@@ -69,18 +75,25 @@ bool user_readable(const void *start, usize size)
 bool user_writeable(const void *start, usize size)
 {
     /* (Final) TODO Begin */
-    bool ret = TRUE;
-    ListNode head = thisproc()->pgdir.section_head;
-    _for_in_list(node, &head)
-    {
-        if (node == &head)
-            continue;
-        auto st = container_of(node, struct section, stnode);
-        if (st->begin <= (u64)start && ((u64)start + size) <= st->end && st->flags != ST_TEXT) {
-            ret = true;
-            break;
+    bool ret;
+    struct pgdir *pd = &thisproc()->pgdir;
+    u32 seq;
+    do {
+        seq = read_seqbegin(&pd->section_lock);
+        ret = FALSE;
+        _for_in_list(node, &pd->section_head)
+        {
+            if (node == &pd->section_head)
+                continue;
+            auto st = container_of(node, struct section, stnode);
+            // the whole range in one section that may be written
+            if (st->begin <= (u64)start && (u64)start + size >= (u64)start &&
+                ((u64)start + size) <= st->end && !(st->flags & ST_RO)) {
+                ret = TRUE;
+                break;
+            }
         }
-    }
+    } while (read_seqretry(&pd->section_lock, seq));
     return ret;
     /* (Final) TODO End */
 }
@@ -5,6 +5,8 @@
 #define SYS_yield 124
 #define SYS_myreport 499
 #define SYS_pstat 500
+#define SYS_memstat 501
+#define SYS_schedstat 502
 #define SYS_sbrk 12
 #define SYS_brk 214
 #define SYS_mprotect 226
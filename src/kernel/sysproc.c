@@ -1,9 +1,19 @@
+#include <common/string.h>
+#include <driver/clock.h>
 #include <kernel/mem.h>
+#include <kernel/memstat.h>
 #include <kernel/paging.h>
 #include <kernel/printk.h>
 #include <kernel/proc.h>
+#include <kernel/schedstat.h>
 #include <kernel/sched.h>
 #include <kernel/syscall.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// about 136 years
+#define MAX_SLEEP_SEC (1ull << 32)
 
 define_syscall(gettid) { return thisproc()->pid; }
 
@@ -28,8 +38,154 @@ define_syscall(yield) {
 
 define_syscall(pstat) { return (u64)left_page_cnt(); }
 
+define_syscall(memstat, struct memstat *st) {
+    if (!user_writeable(st, sizeof(*st)))
+        return -1;
+    // take the snapshot into kernel memory: user pages may still fault
+    struct memstat *buf = kalloc(sizeof(struct memstat));
+    if (buf == NULL)
+        return -1;
+    get_memstat(buf);
+    memcpy(st, buf, sizeof(struct memstat));
+    kfree(buf);
+    return 0;
+}
+
+define_syscall(schedstat, struct schedstat *st) {
+    if (!user_writeable(st, sizeof(*st)))
+        return -1;
+    struct schedstat *buf = kalloc(sizeof(struct schedstat));
+    if (buf == NULL)
+        return -1;
+    get_schedstat(buf);
+    memcpy(st, buf, sizeof(struct schedstat));
+    kfree(buf);
+    return 0;
+}
+
+// there is no RTC: every clock counts from boot
+define_syscall(clock_gettime, int clockid, struct timespec *tp) {
+    (void)clockid;
+    if (!user_writeable(tp, sizeof(*tp)))
+        return -1;
+    u64 t = get_timestamp(), freq = get_clock_frequency();
+    tp->tv_sec = t / freq;
+    tp->tv_nsec = t % freq * 1000000000 / freq;
+    return 0;
+}
+
+define_syscall(nanosleep, const struct timespec *req, struct timespec *rem) {
+    if (!user_readable(req, sizeof(*req)) ||
+        (rem && !user_writeable(rem, sizeof(*rem))))
+        return -1;
+    if (req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+        return -EINVAL;
+    // keep the tick count and the deadline from wrapping
+    u64 sec = MIN((u64)req->tv_sec, MAX_SLEEP_SEC);
+    u64 freq = get_clock_frequency();
+    u64 left = sleep_for(sec * freq + (u64)req->tv_nsec * freq / 1000000000);
+    if (!left)
+        return 0;
+    if (rem) {
+        rem->tv_sec = left / freq;
+        rem->tv_nsec = left % freq * 1000000000 / freq;
+    }
+    return -1;
+}
+
 define_syscall(sbrk, i64 size) { return sbrk(size); }
 
+define_syscall(setpriority, int which, int who, int prio) {
+    if (which != PRIO_PROCESS)
+        return -1;
+    Proc *p = get_proc(who);
+    if (p == NULL)
+        return -1;
+    set_proc_nice(p, prio);
+    put_proc(p);
+    return 0;
+}
+
+// param points to a struct sched_param, whose only field is the int
+// sched_priority
+define_syscall(sched_setscheduler, int pid, int policy, const int *param) {
+    if (!user_readable(param, sizeof(int)))
+        return -1;
+    Proc *p = get_proc(pid);
+    if (p == NULL)
+        return -1;
+    bool ok = set_proc_policy(p, policy, *param);
+    put_proc(p);
+    return ok ? 0 : -1;
+}
+
+define_syscall(sched_getscheduler, int pid) {
+    Proc *p = get_proc(pid);
+    if (p == NULL)
+        return -1;
+    int policy = get_proc_policy(p, NULL);
+    put_proc(p);
+    return policy;
+}
+
+define_syscall(sched_getparam, int pid, int *param) {
+    if (!user_writeable(param, sizeof(int)))
+        return -1;
+    Proc *p = get_proc(pid);
+    if (p == NULL)
+        return -1;
+    int rt_priority;
+    get_proc_policy(p, &rt_priority);
+    put_proc(p);
+    *param = rt_priority;
+    return 0;
+}
+
+// only the first 64 bits of the user's cpu_set_t mean anything here
+define_syscall(sched_setaffinity, int pid, usize len, const void *mask) {
+    u64 bits = 0;
+    len = MIN(len, sizeof(bits));
+    if (!user_readable(mask, len))
+        return -1;
+    memcpy(&bits, mask, len);
+    Proc *p = get_proc(pid);
+    if (p == NULL)
+        return -1;
+    bool ok = set_proc_affinity(p, bits);
+    bool self = p == thisproc();
+    put_proc(p);
+    // leave a CPU we may no longer run on right away
+    if (ok && self)
+        yield();
+    return ok ? 0 : -1;
+}
+
+// like Linux, return the number of bytes written
+define_syscall(sched_getaffinity, int pid, usize len, void *mask) {
+    u64 bits;
+    if (len < sizeof(bits) || !user_writeable(mask, sizeof(bits)))
+        return -1;
+    Proc *p = get_proc(pid);
+    if (p == NULL)
+        return -1;
+    bits = get_proc_affinity(p);
+    put_proc(p);
+    memcpy(mask, &bits, sizeof(bits));
+    return sizeof(bits);
+}
+
+// like Linux, return 20 - nice so that the result is never negative
+define_syscall(getpriority, int which, int who) {
+    if (which != PRIO_PROCESS)
+        return -1;
+    Proc *p = get_proc(who);
+    if (p == NULL)
+        return -1;
+    int nice = get_proc_nice(p);
+    put_proc(p);
+    return 20 - nice;
+}
+
 define_syscall(clone, int flag, void *childstk) {
     if (flag != 17) {
         printk("sys_clone: flags other than SIGCHLD are not supported.\n");
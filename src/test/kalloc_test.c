@@ -7,6 +7,8 @@
 #include <test/test.h>
 
 extern RefCount kalloc_page_cnt;
+extern bool page_cache_enabled;
+extern bool slab_magazine_enabled;
 
 static RefCount x;
 static void *p[4][10000];
@@ -23,30 +25,25 @@ static short sz[4][10000];
     while (x.count < 4 * i); \
     arch_dsb_sy();
 
-void kalloc_test() {
-    int i = cpuid();
-    int r = kalloc_page_cnt.count;
-    int y = 10000 - i * 500;
-    if (i == 0)
-        printk("\n\nkalloc_test\n");
-    SYNC(1)
-    for (int j = 0; j < y; j++) {
+// alloc and free y pages back to back, report page ops per millisecond
+static void page_throughput(int i, int y, const char *mode)
+{
+    u64 t0 = get_timestamp();
+    for (int j = 0; j < y; j++)
         p[i][j] = kalloc_page();
-        if (!p[i][j] || ((u64)p[i][j] & 4095))
-            FAIL("FAIL: kalloc_page() = %p\n", p[i][j]);
-        memset(p[i][j], i ^ j, PAGE_SIZE);
-    }
-    for (int j = 0; j < y; j++) {
-        u8 m = (i ^ j) & 255;
-        for (int k = 0; k < PAGE_SIZE; k++)
-            if (((u8 *)p[i][j])[k] != m)
-                FAIL("FAIL: page[%d][%d] wrong\n", i, j);
+    for (int j = 0; j < y; j++)
         kfree_page(p[i][j]);
-    }
-    SYNC(2)
-    if (kalloc_page_cnt.count != r)
-        FAIL("FAIL: kalloc_page_cnt %d -> %lld\n", r, kalloc_page_cnt.count);
-    SYNC(3)
+    u64 t = MAX(get_timestamp() - t0, 1ull);
+    printk("CPU %d: %s %lld page ops/ms\n", i, mode,
+           2ll * y * (i64)get_clock_frequency() / 1000 / (i64)t);
+}
+
+// the mixed-size phase: random kalloc/kfree until 10000 objects are live
+static void mixed_phase(int i, const char *mode)
+{
+    srand(1111 * (i + 1));
+    u64 t0 = get_timestamp();
+    i64 ops = 0;
     for (int j = 0; j < 10000;) {
         if (j < 1000 || rand() > RAND_MAX / 16 * 7) {
             int z = 0;
@@ -76,6 +73,7 @@ void kalloc_test() {
                 FAIL("FAIL: kalloc(%d) = %p\n", z, p[i][j]);
             memset(p[i][j], i ^ z, z);
             j++;
+            ops++;
         } else {
             int k = rand() % j;
             if (p[i][k] == NULL)
@@ -87,9 +85,93 @@ void kalloc_test() {
             kfree(p[i][k]);
             p[i][k] = p[i][--j];
             sz[i][k] = sz[i][j];
+            ops++;
         }
     }
+    u64 t = MAX(get_timestamp() - t0, 1ull);
+    printk("CPU %d: %s %lld kalloc/kfree ops/ms\n", i, mode,
+           ops * (i64)get_clock_frequency() / 1000 / (i64)t);
+}
+
+void kalloc_test() {
+    int i = cpuid();
+    int r = kalloc_page_cnt.count;
+    int y = 10000 - i * 500;
+    if (i == 0)
+        printk("\n\nkalloc_test\n");
+    SYNC(1)
+    for (int j = 0; j < y; j++) {
+        p[i][j] = kalloc_page();
+        if (!p[i][j] || ((u64)p[i][j] & 4095))
+            FAIL("FAIL: kalloc_page() = %p\n", p[i][j]);
+        memset(p[i][j], i ^ j, PAGE_SIZE);
+    }
+    for (int j = 0; j < y; j++) {
+        u8 m = (i ^ j) & 255;
+        for (int k = 0; k < PAGE_SIZE; k++)
+            if (((u8 *)p[i][j])[k] != m)
+                FAIL("FAIL: page[%d][%d] wrong\n", i, j);
+        kfree_page(p[i][j]);
+    }
+    SYNC(2)
+    if (kalloc_page_cnt.count != r)
+        FAIL("FAIL: kalloc_page_cnt %d -> %lld\n", r, kalloc_page_cnt.count);
+    SYNC(3)
+    if (i == 0)
+        page_cache_enabled = false;
     SYNC(4)
+    page_throughput(i, y, "global list");
+    SYNC(5)
+    if (i == 0)
+        page_cache_enabled = true;
+    SYNC(6)
+    page_throughput(i, y, "per-cpu cache");
+    SYNC(7)
+    for (int j = 0; j < 64; j++) {
+        int order = j % 7;
+        p[i][j] = kalloc_pages(order);
+        if (!p[i][j] || (K2P(p[i][j]) & ((PAGE_SIZE << order) - 1)))
+            FAIL("FAIL: kalloc_pages(%d) = %p\n", order, p[i][j]);
+        memset(p[i][j], i ^ j, PAGE_SIZE << order);
+    }
+    for (int j = 0; j < 64; j++) {
+        int order = j % 7;
+        u8 m = (i ^ j) & 255;
+        for (int k = 0; k < PAGE_SIZE << order; k += PAGE_SIZE / 4)
+            if (((u8 *)p[i][j])[k] != m)
+                FAIL("FAIL: pages[%d][%d] wrong\n", i, j);
+        kfree_pages(p[i][j], order);
+    }
+    // large kalloc path: page runs sized to the request
+    for (int j = 0; j < 64; j++) {
+        sz[i][j] = 2048 + (j + 1) * 256;
+        p[i][j] = kalloc(sz[i][j]);
+        if (!p[i][j] || PAGE_BASE((u64)p[i][j]) != (u64)p[i][j])
+            FAIL("FAIL: kalloc(%d) = %p\n", sz[i][j], p[i][j]);
+        memset(p[i][j], i ^ j, sz[i][j]);
+    }
+    for (int j = 0; j < 64; j++) {
+        u8 m = (i ^ j) & 255;
+        if (((u8 *)p[i][j])[sz[i][j] - 1] != m)
+            FAIL("FAIL: large[%d][%d] wrong\n", i, j);
+        kfree(p[i][j]);
+    }
+    SYNC(8)
+    if (kalloc_page_cnt.count != r)
+        FAIL("FAIL: kalloc_page_cnt %d -> %lld\n", r, kalloc_page_cnt.count);
+    SYNC(9)
+    if (i == 0)
+        slab_magazine_enabled = false;
+    SYNC(10)
+    mixed_phase(i, "shared slab lists");
+    for (int j = 0; j < 10000; j++)
+        kfree(p[i][j]);
+    SYNC(11)
+    if (i == 0)
+        slab_magazine_enabled = true;
+    SYNC(12)
+    mixed_phase(i, "per-cpu magazines");
+    SYNC(13)
     if (cpuid() == 0) {
         i64 z = 0;
         for (int j = 0; j < 4; j++)
@@ -97,12 +179,12 @@ void kalloc_test() {
                 z += sz[j][k];
         printk("Total: %lld\nUsage: %lld\n", z, kalloc_page_cnt.count - r);
     }
-    SYNC(5)
+    SYNC(14)
     for (int j = 0; j < 10000; j++){
         kfree(p[i][j]);
     }
 
-    SYNC(6)
+    SYNC(15)
     if (cpuid() == 0)
         printk("kalloc_test PASS\n");
 }
@@ -65,7 +65,7 @@ void pgfault_first_test() {
     sbrk(limit * PAGE_SIZE);
     for (i64 i = 0; i < limit; ++i) {
         u64 va = i * PAGE_SIZE;
-        vmmap(pd, va, get_zero_page(), PTE_RO | PTE_USER_DATA);
+        ASSERT(vmmap(pd, va, get_zero_page(), PTE_RO | PTE_USER_DATA) == 0);
         ASSERT(*(i64 *)va == 0);
     }
     ASSERT(pc == left_page_cnt());
@@ -99,7 +99,7 @@ void pgfault_second_test() {
     sbrk(limit * PAGE_SIZE);
     for (i64 i = 0; i < limit / 2; ++i) {
         u64 va = i * PAGE_SIZE;
-        vmmap(pd, va, get_zero_page(), PTE_RO | PTE_USER_DATA);
+        ASSERT(vmmap(pd, va, get_zero_page(), PTE_RO | PTE_USER_DATA) == 0);
     }
     arch_tlbi_vmalle1is();
     for (i64 i = 0; i < limit; ++i) {
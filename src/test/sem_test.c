@@ -0,0 +1,71 @@
+#include <common/sem.h>
+#include <driver/clock.h>
+#include <kernel/printk.h>
+#include <kernel/proc.h>
+#include <kernel/sched.h>
+#include <test/test.h>
+
+#define ROUNDS 10000
+
+void set_parent_to_this(Proc *proc);
+
+static Semaphore ping, pong;
+static volatile int nr_pongs;
+
+static void pong_entry(u64 arg)
+{
+    (void)arg;
+    for (int r = 0; r < ROUNDS; r++) {
+        unalertable_wait_sem(&ping);
+        nr_pongs++;
+        post_sem(&pong);
+    }
+    exit(0);
+}
+
+static void ping_entry(u64 arg)
+{
+    (void)arg;
+    for (int r = 0; r < ROUNDS; r++) {
+        post_sem(&ping);
+        unalertable_wait_sem(&pong);
+    }
+    exit(0);
+}
+
+static Proc *start_pinned(void (*entry)(u64), int cpu)
+{
+    Proc *p = create_proc();
+    ASSERT(set_proc_affinity(p, BIT(cpu)));
+    set_parent_to_this(p);
+    start_proc(p, entry, 0);
+    return p;
+}
+
+// bounce a semaphore pair ROUNDS times between a proc on `cpu0` and one on
+// `cpu1`, and report the average ns of one round trip (two sleeps and two
+// wakeups)
+static void ping_pong(int cpu0, int cpu1)
+{
+    init_sem(&ping, 0);
+    init_sem(&pong, 0);
+    nr_pongs = 0;
+    u64 t0 = get_timestamp();
+    start_pinned(pong_entry, cpu1);
+    start_pinned(ping_entry, cpu0);
+    int code;
+    for (int i = 0; i < 2; i++) {
+        ASSERT(wait(&code) != -1);
+        ASSERT(code == 0);
+    }
+    u64 t = get_timestamp() - t0;
+    ASSERT(nr_pongs == ROUNDS);
+    printk("sem ping-pong CPU %d <-> CPU %d: %lld ns per round trip\n", cpu0,
+           cpu1, (i64)(t * 1000000000 / get_clock_frequency() / ROUNDS));
+}
+
+void sem_test()
+{
+    ping_pong(0, 1);
+    ping_pong(0, 0);
+}
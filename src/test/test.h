@@ -9,6 +9,8 @@ void proc_test();
 void vm_test();
 void user_proc_test();
 void io_test();
+void timer_test();
+void sem_test();
 unsigned rand();
 void srand(unsigned seed);
 void pgfault_first_test();
@@ -0,0 +1,85 @@
+#include <aarch64/intrinsic.h>
+#include <driver/clock.h>
+#include <kernel/cpu.h>
+#include <kernel/printk.h>
+#include <test/test.h>
+
+#define NTIMER 256
+#define ROUNDS 10000
+#define PROBE_ELAPSE 2 // as the scheduler tick
+
+#define FAIL(...)            \
+    {                        \
+        printk(__VA_ARGS__); \
+        while (1);           \
+    }
+
+static struct timer timers[NCPU][NTIMER], probe[NCPU];
+static volatile int nr_fired[NCPU];
+
+static void test_handler(struct timer *t)
+{
+    u64 now = get_timestamp();
+    if (now < t->_key)
+        FAIL("CPU %lld: timer fired %lld ticks early\n", cpuid(),
+             t->_key - now);
+    nr_fired[cpuid()]++;
+}
+
+// report the average ns of a set_cpu_timer/cancel_cpu_timer pair
+static void bench_set_cancel(int i, const char *what)
+{
+    probe[i].elapse = ms_to_ticks(PROBE_ELAPSE);
+    probe[i].handler = test_handler;
+    u64 t0 = get_timestamp();
+    for (int r = 0; r < ROUNDS; r++) {
+        set_cpu_timer(&probe[i]);
+        cancel_cpu_timer(&probe[i]);
+    }
+    u64 t = get_timestamp() - t0;
+    printk("CPU %d: set+cancel %s: %lld ns\n", i, what,
+           (i64)(t * 1000000000 / get_clock_frequency() / ROUNDS));
+}
+
+// arm NTIMER timers due within 200 ms and wait for all of them
+static void fire_all(int i, u64 slack)
+{
+    nr_fired[i] = 0;
+    u64 t0 = get_timestamp_ms(), irqs = cpus[i].nr_timer_irqs;
+    for (int j = 0; j < NTIMER; j++) {
+        // sub-ms offsets, so that only slack lets them share interrupts
+        timers[i][j].elapse = us_to_ticks(rand() % 2000 * 100);
+        timers[i][j].slack = slack;
+        set_cpu_timer(&timers[i][j]);
+    }
+    arch_with_trap
+    {
+        while (nr_fired[i] < NTIMER)
+            arch_wfi();
+    }
+    printk("CPU %d: %d timers with %lld us slack fired within %lld ms, "
+           "%lld clock interrupts\n",
+           i, NTIMER, (i64)ticks_to_us(slack), get_timestamp_ms() - t0,
+           cpus[i].nr_timer_irqs - irqs);
+}
+
+void timer_test()
+{
+    int i = cpuid();
+    // the pair update_this_proc does on every switch, first on a quiet
+    // wheel, then with NTIMER timers spread over all of its levels
+    bench_set_cancel(i, "alone");
+    for (int j = 0; j < NTIMER; j++) {
+        timers[i][j].elapse = ms_to_ticks(1000 + rand() % 3600000);
+        timers[i][j].handler = test_handler;
+        set_cpu_timer(&timers[i][j]);
+    }
+    bench_set_cancel(i, "with 256 timers");
+    for (int j = 0; j < NTIMER; j++)
+        cancel_cpu_timer(&timers[i][j]);
+
+    // expiry: every timer must fire, and none before its deadline. with
+    // slack, the same timers should need fewer clock interrupts
+    fire_all(i, 0);
+    fire_all(i, ms_to_ticks(5));
+}
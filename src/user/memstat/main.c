@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kernel/memstat.h>
+#include <kernel/syscallno.h>
+
+// memstat [-r ms]: print the kernel allocator state. with -r, sample twice
+// `ms` milliseconds apart and also print the allocation rates.
+
+static struct memstat st, st0;
+
+static int get_memstat(struct memstat *s)
+{
+    return syscall(SYS_memstat, s);
+}
+
+int main(int argc, char *argv[])
+{
+    long interval = 0;
+    if (argc == 3 && strcmp(argv[1], "-r") == 0) {
+        interval = atol(argv[2]);
+    } else if (argc != 1) {
+        printf("Usage: memstat [-r ms]\n");
+        exit(1);
+    }
+    if (get_memstat(&st) < 0) {
+        printf("memstat: syscall failed\n");
+        exit(1);
+    }
+    if (interval > 0) {
+        st0 = st;
+        usleep(interval * 1000);
+        get_memstat(&st);
+    }
+
+    printf("pages: %llu used, %llu free, %llu peak, %llu total\n",
+           st.used_pages, st.total_pages - st.used_pages, st.peak_used_pages,
+           st.total_pages);
+    printf("cpu  page_cache  zero_pool\n");
+    for (int i = 0; i < MEMSTAT_NCPU; i++)
+        printf("%3d  %10llu  %9llu\n", i, st.page_cache[i], st.zero_pool[i]);
+    printf("buddy free blocks by order:");
+    for (int i = 0; i < MEMSTAT_NORDER; i++)
+        printf(" %llu", st.buddy_free[i]);
+    printf("\n");
+
+    printf("%-16s %6s %8s %8s %6s %6s\n", "cache", "size", "inuse", "free",
+           "pages", "frag%");
+    for (u64 i = 0; i < st.nr_caches; i++) {
+        struct memstat_cache *c = &st.caches[i];
+        // share of the cache's slab pages not holding live objects
+        u64 frag = 100 - c->objs_inuse * c->obj_size * 100 / (c->pages * 4096);
+        printf("%-16s %6llu %8llu %8llu %6llu %5llu%%\n", c->name, c->obj_size,
+               c->objs_inuse, c->objs_free, c->pages, frag);
+    }
+
+    printf("since boot: %llu page allocs, %llu page frees, %llu object "
+           "allocs, %llu object frees\n",
+           st.page_allocs, st.page_frees, st.obj_allocs, st.obj_frees);
+    if (interval > 0) {
+        u64 ms = st.uptime_ms - st0.uptime_ms;
+        printf("rates over %llu ms: %llu page allocs/s, %llu page frees/s, "
+               "%llu object allocs/s, %llu object frees/s\n",
+               ms, (st.page_allocs - st0.page_allocs) * 1000 / ms,
+               (st.page_frees - st0.page_frees) * 1000 / ms,
+               (st.obj_allocs - st0.obj_allocs) * 1000 / ms,
+               (st.obj_frees - st0.obj_frees) * 1000 / ms);
+    }
+    exit(0);
+}
@@ -0,0 +1,134 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kernel/schedstat.h>
+#include <kernel/syscallno.h>
+
+// top [-d ms] [-n count]: sample the scheduler statistics every `ms`
+// milliseconds (default 1000) and print CPU usage and the procs by the CPU
+// time they took in the interval. -n stops after `count` screens.
+
+static struct schedstat st, st0;
+
+static int get_schedstat(struct schedstat *s)
+{
+    return syscall(SYS_schedstat, s);
+}
+
+static const char *state_name(int state)
+{
+    static const char *names[] = {"unused", "runnable", "running",
+                                  "sleeping", "deepsleep", "zombie"};
+    if (state < 0 || state > 5)
+        return "?";
+    return names[state];
+}
+
+static const char *policy_name(int policy)
+{
+    if (policy == SCHED_FIFO)
+        return "fifo";
+    if (policy == SCHED_RR)
+        return "rr";
+    return "normal";
+}
+
+static struct schedstat_proc *find_proc(struct schedstat *s, int pid)
+{
+    for (u64 i = 0; i < s->nr_procs; i++)
+        if (s->procs[i].pid == pid)
+            return &s->procs[i];
+    return NULL;
+}
+
+// the runtime a proc gained since the previous sample
+static u64 delta_runtime(struct schedstat_proc *p)
+{
+    struct schedstat_proc *old = find_proc(&st0, p->pid);
+    return old && old->runtime_us <= p->runtime_us ?
+                   p->runtime_us - old->runtime_us :
+                   p->runtime_us;
+}
+
+// the waits that fell in each bucket since the previous sample
+static void print_hist(u64 *hist, u64 *hist0)
+{
+    for (int i = 0; i < SCHEDSTAT_NBUCKET; i++)
+        printf(" %7llu", hist[i] - hist0[i]);
+    printf("\n");
+}
+
+static void print_screen(u64 ms)
+{
+    printf("\ntop: uptime %llu ms, %llu procs, interval %llu ms\n",
+           st.uptime_ms, st.nr_procs, ms);
+    printf("cpu  busy%%  switches  irqs  queued  wait <10us  <100us    <1ms"
+           "   <10ms  <100ms  longer\n");
+    for (int i = 0; i < SCHEDSTAT_NCPU; i++) {
+        struct schedstat_cpu *c = &st.cpus[i], *c0 = &st0.cpus[i];
+        u64 busy = c->busy_us - c0->busy_us;
+        u64 total = busy + c->idle_us - c0->idle_us;
+        printf("%3d  %4llu%%  %8llu  %4llu  %6llu     ", i,
+               total ? busy * 100 / total : 0, c->nr_switches - c0->nr_switches,
+               c->nr_timer_irqs - c0->nr_timer_irqs, c->nr_running);
+        print_hist(c->wait_hist, c0->wait_hist);
+    }
+
+    // sort by the CPU time taken in the interval, busiest first
+    static struct schedstat_proc *order[SCHEDSTAT_MAX_PROCS];
+    static u64 cpu_us[SCHEDSTAT_MAX_PROCS];
+    for (u64 i = 0; i < st.nr_procs; i++) {
+        u64 d = delta_runtime(&st.procs[i]);
+        u64 j = i;
+        for (; j > 0 && cpu_us[j - 1] < d; j--) {
+            order[j] = order[j - 1];
+            cpu_us[j] = cpu_us[j - 1];
+        }
+        order[j] = &st.procs[i];
+        cpu_us[j] = d;
+    }
+
+    printf("%5s %-9s %3s %4s %-6s %3s %5s %10s %8s %8s\n", "pid", "state",
+           "cpu", "nice", "policy", "pri", "cpu%", "time(ms)", "vol", "invol");
+    for (u64 i = 0; i < st.nr_procs; i++) {
+        struct schedstat_proc *p = order[i];
+        printf("%5d %-9s %3d %4d %-6s %3d %4llu%% %10llu %8llu %8llu\n",
+               p->pid, state_name(p->state), p->cpu, p->nice,
+               policy_name(p->policy), p->rt_priority,
+               ms ? cpu_us[i] / 10 / ms : 0, p->runtime_us / 1000,
+               p->nr_voluntary, p->nr_involuntary);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    long interval = 1000, count = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            interval = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atol(argv[++i]);
+        } else {
+            printf("Usage: top [-d ms] [-n count]\n");
+            exit(1);
+        }
+    }
+    if (interval <= 0)
+        interval = 1000;
+    if (get_schedstat(&st) < 0) {
+        printf("top: syscall failed\n");
+        exit(1);
+    }
+    while (count != 0) {
+        st0 = st;
+        usleep(interval * 1000);
+        get_schedstat(&st);
+        print_screen(st.uptime_ms - st0.uptime_ms);
+        if (count > 0)
+            count--;
+    }
+    exit(0);
+}